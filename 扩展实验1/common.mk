@@ -12,6 +12,31 @@ CFLAGS += -MD
 CFLAGS += -mcmodel=medany
 CFLAGS += -ffreestanding -fno-common -nostdlib -mno-relax
 CFLAGS += -I.
+# 调试用: make PMEM_POISON=1 时 pmem 在分配/释放时填充 0x05/0x01, 默认关闭
+PMEM_POISON ?= 0
+ifeq ($(PMEM_POISON),1)
+CFLAGS += -DPMEM_POISON
+endif
+# 对比测试用: make VM_NO_ASID=1 时不使用 ASID, 每次切换地址空间都整体刷新 TLB
+VM_NO_ASID ?= 0
+ifeq ($(VM_NO_ASID),1)
+CFLAGS += -DVM_NO_ASID
+endif
+# 对比测试用: make PROC_NO_SHELL_CACHE=1 时不缓存进程外壳, 每次创建进程都重新分配内核栈/trapframe/根页表
+PROC_NO_SHELL_CACHE ?= 0
+ifeq ($(PROC_NO_SHELL_CACHE),1)
+CFLAGS += -DPROC_NO_SHELL_CACHE
+endif
+# 对比测试用: make VM_NO_THP=1 时用户堆不使用 2MiB 大页, 全部按 4KiB 页按需分配
+VM_NO_THP ?= 0
+ifeq ($(VM_NO_THP),1)
+CFLAGS += -DVM_NO_THP
+endif
+# 对比测试用: make VM_NO_KSM=1 时关闭相同页合并扫描
+VM_NO_KSM ?= 0
+ifeq ($(VM_NO_KSM),1)
+CFLAGS += -DVM_NO_KSM
+endif
 CFLAGS += $(shell $(CC) -fno-stack-protector -E -x c /dev/null >/dev/null 2>&1 && echo -fno-stack-protector)
 
 # Disable PIE when possible (for Ubuntu 16.10 toolchain)
@@ -0,0 +1,12 @@
+#ifndef __FDT_H__
+#define __FDT_H__
+
+#include "common.h"
+
+// QEMU 在 a1 中传入的扁平设备树 (FDT) 地址, 由 start() 在 M 态记录
+extern uint64 boot_fdt;
+
+void   fdt_init(void);      // 解析设备树, 找出内核所在的那段内存 (必须在 pmem_init 之前, 之后 FDT 所在的页会被回收)
+uint64 fdt_mem_end(void);   // 物理内存的上界, 没有可用的设备树时为 PHYSTOP_DEFAULT
+
+#endif
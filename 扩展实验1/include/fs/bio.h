@@ -26,5 +26,6 @@ void bwrite(struct buf *b);
 void brelse(struct buf *b);
 void bpin(struct buf *b);
 void bunpin(struct buf *b);
+uint32 bio_mem_pages(void);
 
 #endif
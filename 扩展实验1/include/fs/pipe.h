@@ -8,9 +8,11 @@ struct file;
 
 struct pipe;
 
+void pipeinit(void);
 int pipealloc(struct file **f0, struct file **f1);
 void pipeclose(struct pipe *pi, int writable);
 int pipewrite(struct pipe *pi, const char *addr, int n);
 int piperead(struct pipe *pi, char *addr, int n);
+uint32 pipe_mem_pages(void);
 
 #endif
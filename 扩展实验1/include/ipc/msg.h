@@ -6,7 +6,7 @@
 
 #define MSG_MAX_SIZE      128
 #define MSG_QUEUE_DEPTH   16
-#define MSG_MAX_QUEUES    32
+#define MSG_MAX_QUEUES    32   // 队列不会被删除, 限制总数以免无限占用内核内存
 
 struct message {
     int len;
@@ -15,6 +15,8 @@ struct message {
 
 struct msgqueue {
     struct spinlock lock;
+    struct msgqueue *next;   // 全局队列链表
+    int qid;
     int key;
     int used;
     int head;
@@ -0,0 +1,44 @@
+#ifndef __IPC_SHM_H__
+#define __IPC_SHM_H__
+
+#include "common.h"
+#include "lib/lock.h"
+
+/*
+    共享内存段 (System V 风格的 shmget/shmat/shmdt)
+
+    段按 key 查找, key 与消息队列 (msg_get) 使用同一种整数命名方式。
+    shmget 时一次分配好全部物理页, 段本身持有每页的一个引用;
+    shmat 建立一个 MAP_SHARED 的 VMA, 把同一批物理页映射进调用进程, 每个映射再各持有一个页引用。
+    nattch 记录有多少个 VMA 映射着这个段 (fork 复制的映射也算在内),
+    最后一个映射解除时段被销毁, 页面随引用计数归零而释放。
+    从未被映射的段在创建它的进程退出时销毁 (shm_exit), 否则它的页面永远不会被释放;
+    系统中同时存在的段数不超过 SHM_MAX_SEGS。
+*/
+
+#define SHM_MAX_SIZE (16 * 1024 * 1024)
+#define SHM_MAX_SEGS 16
+
+struct proc;
+
+struct shmseg {
+    int id;
+    int key;
+    uint64 size;          // 页对齐后的大小
+    uint32 npages;
+    int nattch;           // 映射着本段的 VMA 数, 由 shmtable.lock 保护
+    int creator;          // 创建本段的进程 pid
+    uint64 *pages;        // 每一页的物理地址
+    struct shmseg *next;  // 全局段链表
+};
+
+void   shm_init(void);
+int    shm_get(int key, uint64 size);
+uint64 shm_attach(struct proc *p, int shmid);
+int    shm_detach(struct proc *p, uint64 addr);
+void   shm_dup(struct shmseg *seg);
+void   shm_put(struct shmseg *seg);
+void   shm_exit(struct proc *p);
+uint64 shm_page(struct shmseg *seg, uint64 idx);
+
+#endif
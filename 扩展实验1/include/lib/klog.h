@@ -4,7 +4,10 @@
 #include "common.h"
 #include "lib/lock.h"
 
+// 启动早期使用的静态缓冲区大小, 也是 klog_read 一次最多读出的字节数
 #define LOG_BUF_SIZE 4096
+// vmalloc 可用之后换用的环形缓冲区大小
+#define LOG_VBUF_SIZE (64 * 1024)
 
 enum {
     LOG_LEVEL_DEBUG = 0,
@@ -15,7 +18,8 @@ enum {
 
 struct klog_buffer {
     spinlock_t lock;
-    char buf[LOG_BUF_SIZE];
+    char *buf;            // 环形缓冲区: 先是静态的 LOG_BUF_SIZE 字节, klog_enlarge 之后来自 vmalloc
+    int size;
     int read_pos;
     int write_pos;
     int level;
@@ -25,6 +29,7 @@ struct klog_buffer {
 extern struct klog_buffer klog_buf;
 
 void klog_init(void);
+void klog_enlarge(void);
 void klog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 int klog_read(char *dst, int n);
 void klog_set_level(int level);
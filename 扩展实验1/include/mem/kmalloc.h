@@ -0,0 +1,43 @@
+#ifndef __KMALLOC_H__
+#define __KMALLOC_H__
+
+#include "common.h"
+
+/*
+    slab 对象分配器
+
+    每个 kmem_cache 管理一种固定大小的对象, 对象存放在 slab 中;
+    一个 slab 是 pmem_alloc(true) 得到的一页, 页首是 slab 头, 其余部分切成等长对象;
+    大于 PGSIZE/8 的对象使用 2^order 页的 slab (至多 8 页), 以免每页尾部浪费大半。
+    每个CPU在 cache 前面还有一个小的对象缓存, 常见的分配/释放无需获取 cache 锁。
+
+    kmalloc 按大小向上取整到 16 ~ 2048 字节的若干个 size class;
+    更大的请求直接从伙伴系统取连续页面。
+*/
+
+typedef struct kmem_cache kmem_cache_t;
+
+// 单个 cache 的统计信息
+typedef struct kmem_cache_stat {
+    const char* name;
+    uint32 obj_size;     // 对象大小(已对齐)
+    uint32 objs_per_slab;
+    uint32 slab_pages;   // 每个 slab 的页数
+    uint32 nr_slabs;     // 当前持有的 slab 数
+    uint32 inuse;        // 已分配出去的对象数
+    uint64 cpu_hits;     // 由CPU对象缓存直接满足的分配次数
+} kmem_cache_stat_t;
+
+void          kmem_init(void);
+kmem_cache_t* kmem_cache_create(const char* name, uint32 size);
+void*         kmem_cache_alloc(kmem_cache_t* cache);
+void          kmem_cache_free(kmem_cache_t* cache, void* obj);
+void          kmem_cache_stat(kmem_cache_t* cache, kmem_cache_stat_t* st);
+
+void* kmalloc(uint32 size);
+void  kfree(void* ptr);
+
+uint32 kmem_slab_pages(void);
+void  kmem_print_stats(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __KSM_H__
+#define __KSM_H__
+
+#include "common.h"
+
+/*
+    相同页合并 (类似 Linux 的 KSM)
+
+    CPU 0 的时钟中断每 KSM_SCAN_TICKS 个 tick 开始一轮扫描 (ksm_tick)。和工作集采样一样,
+    每个进程在下一次返回用户态之前扫描自己 [0, sz) 中的一批匿名页 (ksm_scan), 页表只由所有者修改:
+    - 全零页直接换成共享零页;
+    - 与稳定表中某一页内容相同: PTE 指向那一页 (只读 + PTE_COW), 释放自己的副本;
+    - 与不稳定表中另一页的内容相同: 把自己这一页登记为稳定页并改为只读,
+      对方下一次扫描时会合并到它上面;
+    - 否则把 (哈希, 页面) 记入不稳定表。
+    稳定页由稳定表持有一个引用, 写入时由 uvm_cow_fault 复制出私有页 (取消合并),
+    只剩稳定表自己的引用时在下一次查找中释放。
+    make VM_NO_KSM=1 时关闭。
+*/
+
+// 扫描周期 (时钟中断数) 和每个进程每轮最多扫描的页数
+#define KSM_SCAN_TICKS 5
+#define KSM_SCAN_BATCH 64
+
+typedef struct ksm_stat {
+    uint64 scans;        // 扫描轮数 (所有进程累计)
+    uint64 scanned;      // 扫描过的页数
+    uint64 merged;       // 合并到稳定页上的次数
+    uint64 zero_merged;  // 合并到共享零页的次数
+    uint64 promoted;     // 登记为稳定页的次数
+    uint64 ticks;        // 扫描花费的时间 (r_time, 1 tick = 100ns)
+    uint32 stable;       // 当前的稳定页数
+    uint32 sharing;      // 映射稳定页的 PTE 数超出稳定页数的部分, 即节省的页数
+} ksm_stat_t;
+
+struct proc;
+
+void ksm_init(void);
+void ksm_tick(void);
+void ksm_scan(struct proc *p);
+void ksm_get_stat(ksm_stat_t *st);
+void ksm_print_stats(void);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __MEMSTAT_H__
+#define __MEMSTAT_H__
+
+#include "common.h"
+#include "mem/wss.h"
+
+/*
+    memstat 系统调用: memstat(slot, buf)
+    slot 为 MEMSTAT_SYSTEM 时把全局的内存分布写入 struct memstat_sys, 返回 0;
+    否则读取进程表第 slot 项, 写入 struct memstat_proc 并返回 1, 该项空闲时返回 0, 越界返回 -1。
+    所有数量的单位都是 4KiB 页。内核与用户程序共用这些结构。
+*/
+
+#define MEMSTAT_SYSTEM (-1)
+
+struct memstat_sys {
+    uint32 image_pages;   // 内核映像 (代码, 数据, bss) 和页面元数据, 不归 pmem 管理
+    uint32 bcache_pages;  // 其中块缓存占用的部分
+    uint32 total_pages;   // pmem 管理的物理页
+    uint32 free_pages;
+    uint32 kernel_pages;  // 内核用途已分配的页
+    uint32 user_pages;    // 用户用途已分配的页
+    uint32 pgtbl_pages;   // 内核页中: 页表
+    uint32 slab_pages;    // 内核页中: slab
+    uint32 pipe_pages;    // slab 中: 管道
+    uint32 proc_pages;    // 内核页中: 进程的内核栈和 trapframe
+    uint32 nproc;         // 使用中的进程表项
+    uint32 nproc_max;     // NPROC
+    uint32 swap_slots;
+    uint32 swap_used;
+    uint32 zero_maps;     // 指向共享零页的映射数 (不占物理页)
+    uint32 ksm_shared;    // 相同页合并得到的稳定页
+    uint32 ksm_sharing;   // 合并到稳定页上而节省的页
+};
+
+struct memstat_proc {
+    int pid;
+    int state;            // enum proc_state
+    char name[16];
+    uint64 sz;            // 堆/栈的大小 (字节)
+    uint64 rss;           // 映射着的用户物理页 (不含共享零页)
+    uint64 shared;        // rss 中与其他进程共享的页
+    uint64 swapped;       // 已换出的页
+    uint64 pgtbl_pages;   // 用户页表
+    uint64 kernel_pages;  // 内核栈和 trapframe
+    uint64 minflt;
+    uint64 majflt;
+    struct ws_stat ws;    // 工作集估计 (进程返回用户态时按周期采样)
+};
+
+void memstat_system(struct memstat_sys *st);
+int  memstat_proc(int slot, struct memstat_proc *st);
+
+#endif
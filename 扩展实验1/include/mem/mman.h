@@ -0,0 +1,23 @@
+#ifndef __MMAN_H__
+#define __MMAN_H__
+
+// mmap 的保护位与标志, 内核与用户程序共用 (取值与 Linux 相同)
+
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+#define MAP_SHARED    0x01     // 写入对其他共享者可见, 脏页在 munmap/exit 时写回文件
+#define MAP_PRIVATE   0x02     // 私有副本, 写入不影响文件
+#define MAP_ANONYMOUS 0x20     // 不关联文件, 页面初始全为 0
+#define MAP_POPULATE  0x8000   // 建立映射时立即填充所有页面
+
+#define MAP_FAILED ((void*)-1)
+
+// madvise 的建议
+#define MADV_NORMAL   0        // 没有特别的建议
+#define MADV_WILLNEED 3        // 马上会访问: 预先填充区间中的页面
+#define MADV_DONTNEED 4        // 不再需要: 释放区间中的页面, 再次访问时重新按需分配 (匿名内存为零页)
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __MMAP_H__
+#define __MMAP_H__
+
+#include "common.h"
+#include "mem/mman.h"
+
+/*
+    mmap: 每个进程的虚拟内存区域 (VMA) 链表
+
+    VMA 按起始地址升序挂在 proc->vmas 上, 位于堆 (p->sz) 之上、MMAP_TOP 之下,
+    新映射从上往下寻找空闲区间。页面按需分配: 缺页时由 mmap_fault 分配物理页,
+    文件映射通过 readi 从 inode 读入内容。
+
+    MAP_SHARED 的可写文件映射先以只读方式映射, 第一次写入时再打开 PTE_W 并置 PTE_D,
+    munmap/exit 时把带 PTE_D 的页写回文件。
+
+    共享内存段 (shmat) 也是一个 MAP_SHARED 的 VMA, 页面来自段本身而不是新分配。
+*/
+
+struct proc;
+struct file;
+struct shmseg;
+
+struct vma {
+    uint64 start;         // 起始地址 (页对齐)
+    uint64 end;           // 结束地址 (页对齐, 不含)
+    int prot;             // PROT_*
+    int flags;            // MAP_*
+    struct file *file;    // 映射的文件, 匿名映射为 NULL
+    uint64 off;           // start 对应的文件偏移 (共享内存段中的偏移)
+    struct shmseg *shm;   // 映射的共享内存段, 每个 VMA 持有段的一个 attach 引用
+    struct vma *next;
+};
+
+void        mmap_init(void);
+uint64      mmap_map(struct proc *p, uint64 len, int prot, int flags, struct file *f, uint64 off);
+uint64      mmap_map_shm(struct proc *p, struct shmseg *seg, uint64 len, int prot);
+int         mmap_unmap(struct proc *p, uint64 addr, uint64 len);
+struct vma* mmap_find(struct proc *p, uint64 va);
+uint64      mmap_floor(struct proc *p);
+int         mmap_fault(struct proc *p, struct vma *v, uint64 va, int type);
+int         mmap_fork(struct proc *p, struct proc *np);
+void        mmap_release(struct proc *p, bool writeback);
+int         mmap_madvise(struct proc *p, uint64 addr, uint64 len, int advice);
+
+#endif
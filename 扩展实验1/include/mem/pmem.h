@@ -8,11 +8,61 @@ extern char KERNEL_DATA[];
 extern char ALLOC_BEGIN[];
 //extern char ALLOC_END[];
 
+// 伙伴系统的最大阶: 最大连续块为 2^9 页 = 2MiB
+#define PMEM_MAX_ORDER 9
+
+// 每个CPU页面缓存的统计信息
+typedef struct pmem_pcp_stat {
+    uint64 hits;     // 直接命中本地缓存的分配次数
+    uint64 refills;  // 批量补充次数(每次补充获取一次全局锁)
+    uint64 drains;   // 批量归还次数(每次归还获取一次全局锁)
+    uint32 cached;   // 当前缓存的页数
+} pmem_pcp_stat_t;
+
+// 预清零页池的统计信息
+typedef struct pmem_zero_stat {
+    uint64 hits;     // pmem_alloc_zeroed 直接从池中取到页面的次数
+    uint64 misses;   // 池为空, 需要现场清零的次数
+    uint64 filled;   // 空闲 hart 后台清零入池的页数
+    uint32 pooled;   // 当前池中的页数
+} pmem_zero_stat_t;
+
 void  pmem_init(void);
 void* pmem_alloc(bool in_kernel);
 void  pmem_free(uint64 page, bool in_kernel);
+// 分配一个内容全为 0 的页面 (优先取预清零池)
+void* pmem_alloc_zeroed(bool in_kernel);
+// 空闲 hart 调用: 后台清零页面补充预清零池, 返回本次清零的页数
+int   pmem_zero_refill(void);
 int pmem_alloc_pages(bool in_kernel, int n, uint64 pages[]);
+void pmem_free_pages(bool in_kernel, int n, uint64 pages[]);
+// 某种用途还能分配的页数 (已扣除该用途的 min 水位线) / 已分配的页数
 uint32 pmem_free_pages_count(bool in_kernel);
+uint32 pmem_used_pages_count(bool in_kernel);
+// zone 管理的总页数 / 内核映像占用的页数
+uint32 pmem_total_pages(void);
+uint32 pmem_image_pages(void);
+uint64 pmem_phystop(void);
+// 查询已分配页面的用途: 1 内核, 0 用户, -1 不是已分配的页面
+int   pmem_owner(uint64 page);
+// 已分配页面的引用计数: pmem_free 只减少计数, 降到 0 才真正释放
+void  pmem_ref_inc(uint64 page);
+uint32 pmem_ref_count(uint64 page);
+// 用户页的年龄: 连续多少个工作集采样周期没有被访问
+uint8 pmem_age(uint64 page);
+void  pmem_set_age(uint64 page, uint8 age);
+// 页表页中非零 PTE 的数量 (只对内核页有意义)
+uint32 pmem_pgtbl_count(uint64 page);
+void   pmem_pgtbl_count_add(uint64 page, int delta);
+// 多页 slab 中每一页到 slab 首页的页数 (只对内核页有意义, 分配时为 0)
+uint32 pmem_slab_index(uint64 page);
+void   pmem_set_slab_index(uint64 page, uint32 idx);
+// 分配/释放 2^order 个物理上连续的页面
+void* pmem_alloc_order(int order, bool in_kernel);
+void  pmem_free_order(uint64 page, int order, bool in_kernel);
 // 分配多个物理页面，包装函数
 int alloc_pages(int n, bool in_kernel, uint64 pages[]);
+void pmem_pcp_stat(int cpu, pmem_pcp_stat_t* st);
+void pmem_zero_stat(pmem_zero_stat_t* st);
+void pmem_print_stats(void);
 #endif
\ No newline at end of file
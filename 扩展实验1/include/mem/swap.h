@@ -0,0 +1,36 @@
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include "common.h"
+#include "mem/vmem.h"
+
+/*
+    交换区: 磁盘上紧跟文件系统之后的一段块 (mkfs 的 swap_mb 参数)
+
+    用户物理页不足时, swap_reclaim 用时钟算法在各进程 [0, sz) 的匿名页中挑选牺牲页:
+    PTE_A 被置位的页面先清除 PTE_A 给第二次机会, 否则写入一个交换槽,
+    PTE 变成 V=0 的交换项 (PTE_SWAP + 槽号 + 原来的权限位)。
+    进程再次访问时由 vm_fault 调用 swap_in 读回。fork 共享交换项时增加槽的引用计数。
+*/
+
+// 用户页分配失败时每次尝试换出的页数
+#define SWAP_RECLAIM_BATCH 16
+
+typedef struct swap_stat {
+    uint32 nslots;       // 交换槽总数 (0 表示没有交换区)
+    uint32 used;         // 正在使用的槽数
+    uint64 swapouts;     // 换出的页数
+    uint64 swapins;      // 换入的页数
+    uint64 scanned;      // 时钟指针扫过的页数
+    uint64 referenced;   // 因 PTE_A 被置位而获得第二次机会的次数
+} swap_stat_t;
+
+void swap_init(void);
+int  swap_reclaim(int npages);
+int  swap_in(struct proc *p, uint64 va);
+void swap_dup(pte_t pte);
+void swap_free(pte_t pte);
+void swap_get_stat(swap_stat_t *st);
+void swap_print_stats(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __VMALLOC_H__
+#define __VMALLOC_H__
+
+#include "common.h"
+
+/*
+    vmalloc: 大块的内核缓冲区
+
+    在内核页表中直接映射之上的 [VMALLOC_BASE, VMALLOC_END) 里分配一段连续的虚拟地址,
+    把逐页从 pmem 取得的 (物理上不连续的) 内核页映射进去。每段后面留一个不映射的保护页。
+    返回的内存不清零。
+
+    vfree 立即解除映射并释放物理页, 但这段虚拟地址先挂在“延迟”状态, 不立刻通知其他 hart:
+    延迟的页数超过 VMALLOC_LAZY_MAX (或地址空间不够) 时才整体清理一次,
+    本 hart 立即刷新 TLB, 其他 hart 在下一次时钟中断中刷新 (vmalloc_tlb_sync),
+    所有 hart 都刷新过之后这些地址才会再次分配出去。
+    vfree 之后仍访问缓冲区是错误的, 所以其他 hart 在此之前残留的 TLB 项不会被用到。
+*/
+
+// 延迟释放的页数达到这么多时做一次清理 (8MiB)
+#define VMALLOC_LAZY_MAX 2048
+
+typedef struct vmalloc_stat {
+    uint32 areas;          // 使用中的区域数
+    uint32 pages;          // 使用中的区域映射的物理页
+    uint32 lazy_pages;     // 已释放但地址还不能重用的页
+    uint64 allocs;
+    uint64 frees;
+    uint64 fails;
+    uint64 purges;         // 清理次数 (每次只在本 hart 刷新一次 TLB)
+    uint64 remote_flushes; // 其他 hart 因清理而做的整体刷新
+} vmalloc_stat_t;
+
+void  vmalloc_init(void);
+void  vmalloc_inithart(void);
+void  vmalloc_tlb_sync(void);
+void* vmalloc(uint64 size);
+void  vfree(void *addr);
+void  vmalloc_get_stat(vmalloc_stat_t *st);
+void  vmalloc_print_stats(void);
+
+#endif
@@ -40,11 +40,17 @@ typedef uint64* pagetable_t;
 // satp寄存器相关
 #define SATP_SV39 (8L << 60)  // MODE = SV39
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12)) // 设置MODE和PPN字段
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK  0xFFFFul
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | (((uint64)(asid) & SATP_ASID_MASK) << SATP_ASID_SHIFT))
 
 // 获取虚拟地址中的虚拟页(VPN)信息 占9bit
 #define VA_SHIFT(level)         (12 + 9 * (level))
 #define VA_TO_VPN(va,level)     ((((uint64)(va)) >> VA_SHIFT(level)) & 0x1FF)
 
+// 各级叶子 PTE 映射的大小: level 0 为 4KiB, level 1 为 2MiB (megapage), level 2 为 1GiB (gigapage)
+#define VM_LEVEL_SIZE(level)    (1ul << VA_SHIFT(level))
+
 // PA和PTE之间的转换
 #define PA_TO_PTE(pa) ((((uint64)(pa)) >> 12) << 10)
 #define PTE_TO_PA(pte) (((pte) >> 10) << 12)
@@ -58,6 +64,15 @@ typedef uint64* pagetable_t;
 #define PTE_G (1 << 5) // global
 #define PTE_A (1 << 6) // accessed
 #define PTE_D (1 << 7) // dirty
+// RSW 位 (硬件忽略, 留给软件使用)
+#define PTE_COW (1 << 8) // 写时复制: 页面被 fork 共享, 写入时需要先复制
+#define PTE_IMG (1 << 9) // 页面直接映射内核中嵌入的程序映像: 不属于 pmem, 解除映射时不释放
+
+// 被换出的页面: V=0 时硬件忽略其余各位, 用第 63 位标记, PPN 字段存放交换槽号, 低 10 位保留原来的权限
+#define PTE_SWAP              (1ull << 63)
+#define PTE_IS_SWAP(pte)      (((pte) & (PTE_V | PTE_SWAP)) == PTE_SWAP)
+#define SWAP_TO_PTE(slot, flags) (PTE_SWAP | ((uint64)(slot) << 10) | ((flags) & 0x3FE))
+#define PTE_TO_SWAP(pte)      ((uint32)(((pte) & ~PTE_SWAP) >> 10))
 
 // 检查一个PTE是否属于pgtbl
 #define PTE_CHECK(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) == 0)
@@ -70,8 +85,21 @@ typedef uint64* pagetable_t;
 
 void   vm_print(pgtbl_t pgtbl);
 pte_t* vm_getpte(pgtbl_t pgtbl, uint64 va, bool alloc);
+pte_t* vm_walk(pgtbl_t pgtbl, uint64 va, bool alloc, int level, int *leaf_level);
+
+// 区间遍历: 每张页表只下降一次, 无效的子树按 2MiB/1GiB 整段跳过
+// 回调对每个叶子 PTE 调用一次, va 为该叶子映射的起始地址, level 为叶子所在级别;
+// 返回负数时终止遍历并把它作为 vm_range_walk 的返回值
+typedef int (*vm_range_fn)(pte_t *pte, uint64 va, int level, void *arg);
+#define VM_RANGE_ALLOC   0x1  // 缺失的页表按需分配, 空的槽位也交给回调
+#define VM_RANGE_SPLIT   0x2  // 只被区间覆盖一部分的大页叶子先拆开再继续 (遍历前一次拆好, 分配失败时不调用回调)
+#define VM_RANGE_SWAP    0x4  // 换出页的交换项 (V=0) 也交给回调
+#define VM_RANGE_FREE    0x8  // 回收遍历后变空的页表页 (只能由地址空间的所有者在解除映射时使用)
+#define VM_RANGE_DESCEND 1    // 回调返回值: 不在这个高级槽位建立大页 (空槽分配下一级页表, 大页叶子先拆开), 继续向下
+void   vm_pte_set(pte_t *pte, pte_t val);
+int    vm_range_walk(pgtbl_t pgtbl, uint64 va, uint64 end, int flags, vm_range_fn fn, void *arg);
 void   vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm);
-void   vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit);
+int    vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit);
 // newAdding 
 // 销毁页表
 void   vm_destroy_pagetable(pgtbl_t root, bool free_leaf);
@@ -81,9 +109,46 @@ int    copyin(pgtbl_t pgtbl, void *dst, uint64 srcva, uint64 len);
 int    copyinstr(pgtbl_t pgtbl, char *dst, uint64 srcva, uint64 max);
 pagetable_t uvmcreate(void);
 void   uvmfree(pagetable_t pagetable, uint64 sz);
+void   uvm_strip(pagetable_t pagetable, uint64 sz, uint64 keep_va);
+int    uvm_discard(pagetable_t pagetable, uint64 va, uint64 end);
 uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz);
 uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz);
+void*  uvm_alloc_page(bool zero);
 int    uvmcopy(pagetable_t old, pagetable_t new_pt, uint64 sz);
+int    uvmcopy_range(pagetable_t old, pagetable_t new_pt, uint64 va, uint64 end, bool shared);
+int    uvm_cow_fault(pagetable_t pagetable, uint64 va);
+int    uvm_map_zero(pagetable_t pagetable, uint64 va, int perm);
+uint64 uvm_zero_page(void);
+uint64 uvm_zero_mappings(void);
+uint64 uvm_resident(pagetable_t pagetable, uint64 sz, uint64 *shared);
+
+// 一个用户地址空间的内存占用 (memstat)
+typedef struct uvm_usage {
+    uint64 resident;   // 映射着的用户物理页 (大页按 4KiB 计, 共享零页不计)
+    uint64 shared;     // 其中和其他进程共享的页 (COW, 共享映射, 程序映像)
+    uint64 swapped;    // 已换出的页
+    uint64 pgtbl;      // 页表页 (含根页表)
+} uvm_usage_t;
+void uvm_usage(pagetable_t pagetable, uvm_usage_t *u);
+uint64 vm_pgtbl_pages(void);
+pgtbl_t kvm_pgtbl(void);
+
+// 用户缺页的访问类型 (对应 scause 12/13/15)
+#define VM_FAULT_EXEC  0
+#define VM_FAULT_READ  1
+#define VM_FAULT_WRITE 2
+
+struct proc;
+int    vm_fault(struct proc *p, uint64 va, int type);
+
+// ASID: 内核使用 ASID 0 和全局(PTE_G)映射, 每个用户进程分配一个 ASID
+uint64 uvm_satp(struct proc *p, int *flush);
+void   uvm_tlb_flush(struct proc *p);
+void   uvm_asid_reset(struct proc *p);
+void   uvm_print_asid_stats(void);
+void   uvm_print_cow_stats(void);
+void   uvm_print_thp_stats(void);
+void   uvm_print_zero_stats(void);
 void   uvmclear(pagetable_t pagetable, uint64 va);
 
 void   kvm_init();
@@ -0,0 +1,40 @@
+#ifndef __WSS_H__
+#define __WSS_H__
+
+#include "common.h"
+
+/*
+    工作集采样: 用 PTE_A / PTE_D 估计每个进程实际在用的页面
+
+    CPU 0 的时钟中断每 WS_SAMPLE_TICKS 个 tick 开始一个新的采样周期 (ws_tick)。
+    页表只由进程自己修改, 所以真正的采样推迟到进程下一次返回用户态之前 (ws_sample):
+    遍历自己的用户页表, 收集并清除 PTE_A (堆/栈中的页面同时清除 PTE_D,
+    文件映射的 PTE_D 还要用来判断写回, 只读取不清除), 并更新物理页的年龄:
+    本周期访问过的页年龄归零, 否则加上错过的周期数。
+    睡眠中的进程不采样, 醒来后的第一次采样一并补上它错过的周期。
+    年龄记在 pmem 的页元数据中, 只对进程独占的页面有意义, 共享页只按本周期是否访问计入工作集。
+    结构体与用户程序共用 (memstat 系统调用返回)。
+*/
+
+// 采样周期 (时钟中断数, 1 tick 约 0.1s)
+#define WS_SAMPLE_TICKS 5
+// 年龄小于 WS_WINDOW 个周期的页面算作工作集
+#define WS_WINDOW 4
+
+struct ws_stat {
+    uint64 samples;   // 已完成的采样次数
+    uint32 wss;       // 工作集估计 (页): 最近 WS_WINDOW 个周期内访问过的页
+    uint32 wss_peak;  // wss 的最大值
+    uint32 accessed;  // 最近一个周期内访问过的页
+    uint32 dirty;     // 其中被写过的页
+    uint32 hot;       // 独占页中年龄为 0 的页
+    uint32 warm;      // 独占页中年龄在 [1, WS_WINDOW) 的页
+    uint32 cold;      // 独占页中年龄不小于 WS_WINDOW 的页, 回收时的首选
+};
+
+struct proc;
+
+void ws_tick(void);
+void ws_sample(struct proc *p);
+
+#endif
@@ -15,6 +15,10 @@
 #define TRAMPOLINE (MAXVA - PGSIZE)
 #define TRAPFRAME  (TRAMPOLINE - PGSIZE)
 
+// mmap 区域的上界, 映射从这里向下分配
+// 系统调用返回值是 int, 映射地址必须小于 2^31 才能原样返回给用户
+#define MMAP_TOP   0x40000000ul
+
 // UART / VirtIO 相关
 #define UART_BASE   0x10000000ul
 #define UART_IRQ    10
@@ -22,8 +26,15 @@
 #define VIRTIO_IRQ  1
 
 // 内核基地址
+// 物理内存的上界在启动时从设备树读出 (见 dev/fdt.h 和 pmem_phystop), 读不到时按 128MiB 处理
+// 最多使用 4GiB: 物理页号用 uint32 记录
 #define KERNEL_BASE 0x80000000ul
-#define PHYSTOP (KERNEL_BASE + 128*1024*1024)
+#define PHYSTOP_DEFAULT (KERNEL_BASE + 128*1024*1024)
+#define PHYSTOP_MAX (KERNEL_BASE + 4ul*1024*1024*1024)
+
+// vmalloc 区域: 只存在于内核页表中, 位于直接映射 (最高到 PHYSTOP_MAX) 之上, 见 mem/vmalloc.h
+#define VMALLOC_BASE 0x2000000000ul
+#define VMALLOC_END  (VMALLOC_BASE + 1024*1024*1024ul)
 
 // platform-level interrupt controller(PLIC)
 #define PLIC_BASE 0x0c000000ul
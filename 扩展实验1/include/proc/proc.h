@@ -5,10 +5,13 @@
 #include "lib/lock.h"
 #include "mem/vmem.h"
 #include "fs/file.h"
+#include "mem/mmap.h"
+#include "mem/wss.h"
 
 #define NPROC 16   // 允许存在的最大进程数
 #define NOFILE 16
 #define EXEC_MAXARG 16   // exec 调用支持的最大参数个数
+#define USTACK_PAGES 8   // 用户栈大小(页), 除栈顶一页外都在第一次访问时才分配
 #define PRIORITY_MIN 0
 #define PRIORITY_MAX 10
 #define PRIORITY_DEFAULT 5
@@ -51,6 +54,7 @@ struct trapframe {
     uint64 t4;
     uint64 t5;
     uint64 t6;
+    uint64 tlb_flush;       // 切换 satp 后是否需要整体刷新 TLB (硬件不支持 ASID 时为 1)
 };
 
 struct proc;
@@ -89,6 +93,7 @@ struct proc {
     enum proc_state state;
     int pid;
     struct proc *parent;
+    int orphan;           // 父进程先退出, 已过继给 init, 退出后由内核自动回收
     int exit_code;
     int killed;
     void *chan;           // sleep/wakeup 使用
@@ -101,7 +106,20 @@ struct proc {
     uint64 kstack;        // 内核栈底（低地址）
     struct context ctx;   // 被调度时需要保存的寄存器
     uint64 sz;            // 用户内存大小
+    uint64 heap_base;     // 堆的起始地址 (exec 时的栈顶), 之下是程序映像和用户栈
+    uint64 lazy_faults;   // 按需分配(缺页)映射的页数
+    uint64 min_flt;       // 不需要磁盘 I/O 的缺页 (按需分配, COW, 匿名映射)
+    uint64 maj_flt;       // 需要读磁盘的缺页 (换入, 文件映射)
+    uint64 ws_epoch;      // 最近一次工作集采样时的采样代数 (0 表示还没采样过)
+    struct ws_stat ws;    // 工作集估计, 见 mem/wss.h
+    uint64 ksm_epoch;     // 最近一次相同页合并扫描时的扫描代数
+    uint64 ksm_next;      // 下一次合并扫描的起始地址, 见 mem/ksm.h
+    struct vma *vmas;     // mmap 映射, 按地址升序
     pagetable_t pagetable;    // 用户页表
+    pagetable_t spare_pagetable; // 进程外壳自带的根页表 (已映射蹦床和 trapframe), 由 proc_pagetable 取用
+    uint16 asid;              // 地址空间标识 (0 表示尚未分配)
+    uint64 asid_gen;          // asid 所属的分配代数, 与全局代数不同时需要重新分配
+    volatile uint32 tlb_stale; // 每个 CPU 一位: 该 CPU 的 TLB 中可能还有本进程已失效的映射
     struct trapframe *trapframe; // 用户态寄存器快照
     struct file *ofile[16];
     struct inode *cwd;
@@ -139,9 +157,12 @@ int setpriority(int pid, int priority);
 int getpriority(int pid);
 pagetable_t proc_pagetable(struct proc *p);
 void proc_freepagetable(pagetable_t pagetable, uint64 sz);
+void proc_recyclepagetable(struct proc *p, pagetable_t pagetable, uint64 sz);
+void proc_print_shell_stats(void);
 int growproc(int n);
 int fork_process(void);
 int exec_process(struct proc *p, const char *path, const char *const argv[]);
+void exec_print_stats(void);
 void userinit(void);
 void scheduler(void) __attribute__((noreturn));
 int proc_tick(void);
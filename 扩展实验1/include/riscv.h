@@ -254,6 +254,12 @@ static inline void w_mcounteren(uint64 x)
   asm volatile("csrw mcounteren, %0" : : "r" (x));
 }
 
+// Supervisor-mode Counter-Enable
+static inline void w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
 static inline uint64 r_mcounteren()
 {
   uint64 x;
@@ -330,6 +336,12 @@ static inline void sfence_vma()
   // the zero, zero means flush all TLB entries.
   asm volatile("sfence.vma zero, zero");
 }
+
+// 只刷新某个 ASID 的非全局 TLB 项 (PTE_G 的内核映射不受影响)
+static inline void sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
 #define MIE_STIE (1L << 5)  // supervisor timer
 // 内存管理相关
 
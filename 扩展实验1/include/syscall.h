@@ -35,6 +35,13 @@ enum syscall_number {
     SYS_msgget,
     SYS_msgsend,
     SYS_msgrecv,
+    SYS_mmap,
+    SYS_munmap,
+    SYS_shmget,
+    SYS_shmat,
+    SYS_shmdt,
+    SYS_memstat,
+    SYS_madvise,
     SYS_MAX,
 };
 
@@ -2,6 +2,14 @@
 #define __USER_H__
 
 #include "common.h"
+#include "mem/mman.h"
+#include "mem/memstat.h"
+
+// open 的模式 (与 fs/file.h 一致)
+#define O_RDONLY 0x000
+#define O_WRONLY 0x001
+#define O_RDWR   0x002
+#define O_CREATE 0x200
 
 int fork(void);
 void exit(int) __attribute__((noreturn));
@@ -30,6 +38,13 @@ int uptime(void);
 int msgget(int key);
 int msgsend(int qid, const void *buf, int len);
 int msgrecv(int qid, void *buf, int maxlen);
+void* mmap(void *addr, uint64 len, int prot, int flags, int fd, uint64 off);
+int munmap(void *addr, uint64 len);
+int madvise(void *addr, uint64 len, int advice);
+int shmget(int key, int size);
+void* shmat(int shmid);
+int shmdt(void *addr);
+int memstat(int slot, void *st);
 int strlen(const char *s);
 void puts(const char *s);
 
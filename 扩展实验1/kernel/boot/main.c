@@ -2,19 +2,26 @@
 #include "lib/print.h"
 #include "lib/klog.h"
 #include "ipc/msg.h"
+#include "ipc/shm.h"
 #include "mem/pmem.h"
 #include "mem/vmem.h"
+#include "mem/kmalloc.h"
+#include "mem/swap.h"
+#include "mem/ksm.h"
+#include "mem/vmalloc.h"
 #include "trap/trap.h"
 #include "dev/timer.h"
 #include "dev/uart.h"
 #include "dev/plic.h"
 #include "dev/virtio_disk.h"
+#include "dev/fdt.h"
 #include "proc/proc.h"
 #include "fs/file.h"
 #include "fs/dir.h"
 #include "fs/fs.h"
 #include "fs/log.h"
 #include "fs/bio.h"
+#include "fs/pipe.h"
 #include "lib/lock.h"
 #include "lib/string.h"
 
@@ -36,12 +43,17 @@ int main()
         // 初始化
         klog_init();
         klog_set_level(LOG_LEVEL_DEBUG);
+        fdt_init();
         pmem_init();
         //printf("Physical memory manager initialized.\n");
+        kmem_init();
         kvm_init();
         //printf("Kernel virtual memory initialized.\n");
         kvm_inithart();
         //printf("Kernel page table for hart %d initialized.\n", cpuid);
+        vmalloc_init();
+        vmalloc_inithart();
+        klog_enlarge();
         trap_init();
         //printf("Trap vectors initialized.\n");
         trap_inithart();
@@ -53,12 +65,17 @@ int main()
         binit();
         //printf("Buffer cache initialized.\n");
         fs_init(ROOTDEV);
+        swap_init();
+        ksm_init();
         //printf("File system initialized.\n");
         proc_init();
         //printf("Process table initialized.\n");
         fileinit();
         //printf("File table initialized.\n");
+        pipeinit();
+        mmap_init();
         msg_init();
+        shm_init();
         //printf("IPC message queues initialized.\n");
         userinit();
         //printf("First user process initialized.\n");
@@ -87,12 +104,16 @@ int main()
         __sync_synchronize();
 
         kvm_inithart();
+        vmalloc_inithart();
         trap_inithart();
         intr_on();
 
         printf("Hart %d idle - waiting for work\n", cpuid);
         while (1) {
-            asm volatile("wfi");
+            // 空闲时在后台清零页面, 池满了才真正休眠
+            if (pmem_zero_refill() == 0) {
+                asm volatile("wfi");
+            }
         }
     }
     return 0;
@@ -109,6 +130,17 @@ static void run_all_tests(void)
     run_priority_mlfq_demo();
     printf("[PRIORITY-DEMO] Scheduler showcase complete\n");
     klog(LOG_LEVEL_INFO, "[PRIORITY-DEMO] showcase complete");
+    pmem_print_stats();
+    kmem_print_stats();
+    uvm_print_cow_stats();
+    uvm_print_thp_stats();
+    uvm_print_zero_stats();
+    uvm_print_asid_stats();
+    exec_print_stats();
+    proc_print_shell_stats();
+    swap_print_stats();
+    ksm_print_stats();
+    vmalloc_print_stats();
     exit_process(0);
 }
 
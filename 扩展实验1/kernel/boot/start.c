@@ -1,14 +1,20 @@
 /* kernel/boot/start.c */
 #include "riscv.h"
 #include "dev/timer.h"
+#include "dev/fdt.h"
 
 void main(); // 声明内核主函数
 //void timerinit(); // 声明定时器初始化函数
 
 __attribute__ ((aligned (16))) uint8 CPU_stack[4096 * NCPU];
 
-void start()
+void start(uint64 hartid, uint64 fdt)
 {
+  // 所有 hart 拿到的是同一棵设备树, 由 hart 0 记录, main 中解析
+  if (hartid == 0) {
+    boot_fdt = fdt;
+  }
+
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
   x |= MSTATUS_MPP_S;
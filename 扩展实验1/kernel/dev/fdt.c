@@ -0,0 +1,130 @@
+#include "dev/fdt.h"
+#include "lib/print.h"
+#include "lib/string.h"
+#include "memlayout.h"
+
+// 扁平设备树 (Devicetree Specification 第 5 章) 中的数都是大端序
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+struct fdt_header {
+    uint32 magic;
+    uint32 totalsize;
+    uint32 off_dt_struct;
+    uint32 off_dt_strings;
+    uint32 off_mem_rsvmap;
+    uint32 version;
+    uint32 last_comp_version;
+    uint32 boot_cpuid_phys;
+    uint32 size_dt_strings;
+    uint32 size_dt_struct;
+};
+
+uint64 boot_fdt;
+static uint64 mem_end = PHYSTOP_DEFAULT;
+
+static uint32 be32(const void *p)
+{
+    const uint8 *b = p;
+    return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// 读取 ncells 个 32 位单元拼成的数 (地址和长度最多两个单元)
+static uint64 read_cells(const uint8 *p, int ncells)
+{
+    uint64 v = 0;
+    for (int i = 0; i < ncells; i++) {
+        v = (v << 32) | be32(p + 4 * i);
+    }
+    return v;
+}
+
+static bool prefix(const char *s, const char *pre)
+{
+    while (*pre) {
+        if (*s++ != *pre++) {
+            return false;
+        }
+    }
+    return *s == '\0' || *s == '@';
+}
+
+// scan_memory: 遍历结构块, 在根节点下的 memory 节点中找包含 KERNEL_BASE 的区间, 返回它的上界 (找不到返回 0)
+static uint64 scan_memory(const struct fdt_header *h)
+{
+    const uint8 *fdt = (const uint8*)h;
+    const uint8 *p = fdt + be32(&h->off_dt_struct);
+    const uint8 *lim = p + be32(&h->size_dt_struct);
+    const char *strs = (const char*)fdt + be32(&h->off_dt_strings);
+    int depth = 0;
+    int addr_cells = 2, size_cells = 1;   // 根节点没有给出时的默认值
+    bool in_memory = false;
+
+    while (p + 4 <= lim) {
+        uint32 tok = be32(p);
+        p += 4;
+        if (tok == FDT_BEGIN_NODE) {
+            const char *name = (const char*)p;
+            depth++;
+            in_memory = (depth == 2 && prefix(name, "memory"));
+            p += (strlen(name) + 1 + 3) & ~3u;   // 节点名连同结尾的 0 按 4 字节对齐
+        } else if (tok == FDT_END_NODE) {
+            depth--;
+            in_memory = false;
+        } else if (tok == FDT_PROP) {
+            uint32 len = be32(p);
+            const char *pname = strs + be32(p + 4);
+            const uint8 *val = p + 8;
+            p = val + ((len + 3) & ~3u);
+            if (depth == 1 && strncmp(pname, "#address-cells", 15) == 0) {
+                addr_cells = be32(val);
+            } else if (depth == 1 && strncmp(pname, "#size-cells", 12) == 0) {
+                size_cells = be32(val);
+            } else if (in_memory && strncmp(pname, "reg", 4) == 0 &&
+                       addr_cells <= 2 && size_cells <= 2) {
+                uint32 step = 4 * (addr_cells + size_cells);
+                for (uint32 off = 0; off + step <= len; off += step) {
+                    uint64 base = read_cells(val + off, addr_cells);
+                    uint64 size = read_cells(val + off + 4 * addr_cells, size_cells);
+                    if (base <= KERNEL_BASE && KERNEL_BASE < base + size) {
+                        return base + size;
+                    }
+                }
+            }
+        } else if (tok == FDT_NOP) {
+            continue;
+        } else {
+            break;   // FDT_END 或无法识别的标记
+        }
+    }
+    return 0;
+}
+
+void fdt_init(void)
+{
+    const struct fdt_header *h = (const struct fdt_header*)boot_fdt;
+    uint64 end = 0;
+    if (boot_fdt >= KERNEL_BASE && boot_fdt < PHYSTOP_MAX && be32(&h->magic) == FDT_MAGIC) {
+        end = scan_memory(h);
+    }
+    if (end == 0) {
+        printf("[fdt] no usable device tree at 0x%lx, assuming %lu MiB\n",
+               boot_fdt, (PHYSTOP_DEFAULT - KERNEL_BASE) >> 20);
+        return;
+    }
+    if (end > PHYSTOP_MAX) {
+        printf("[fdt] only the first %lu MiB of memory is used\n", (PHYSTOP_MAX - KERNEL_BASE) >> 20);
+        end = PHYSTOP_MAX;
+    }
+    mem_end = PG_ROUND_DOWN(end);
+    printf("[fdt] memory 0x%lx-0x%lx (%lu MiB)\n", KERNEL_BASE, mem_end, (mem_end - KERNEL_BASE) >> 20);
+}
+
+uint64 fdt_mem_end(void)
+{
+    return mem_end;
+}
@@ -34,6 +34,7 @@
 #define VIRTIO_MMIO_QUEUE_USED_LOW       0x0a0
 #define VIRTIO_MMIO_QUEUE_USED_HIGH      0x0a4
 #define VIRTIO_MMIO_QUEUE_PFN            0x040
+#define VIRTIO_MMIO_CONFIG               0x100  // virtio-blk 配置空间, 开头是 64 位的容量(扇区数)
 
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE 1
 #define VIRTIO_CONFIG_S_DRIVER      2
@@ -117,6 +118,8 @@ static inline uint64 kvaddr_to_pa(void *addr)
     return (uint64)addr;
 }
 
+static uint64 disk_capacity;   // 磁盘容量 (512 字节扇区数)
+
 static inline void virtio_fence(void)
 {
     asm volatile("fence rw, rw");
@@ -176,6 +179,10 @@ void virtio_disk_init(void)
         panic("virtio_disk_init: FEATURES_OK not accepted");
     }
 
+    disk_capacity = (uint64)*R(VIRTIO_MMIO_CONFIG) |
+                    ((uint64)*R(VIRTIO_MMIO_CONFIG + 4) << 32);
+    printf("[virtio] capacity=%llu sectors\n", disk_capacity);
+
     *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
     uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
     if (max == 0 || max < VIRTIO_DESC_NUM) {
@@ -224,6 +231,11 @@ void virtio_disk_init(void)
     *R(VIRTIO_MMIO_STATUS) = status;
 }
 
+uint64 virtio_disk_capacity(void)
+{
+    return disk_capacity;
+}
+
 static int alloc_desc(void)
 {
     for (int i = 0; i < VIRTIO_DESC_NUM; i++) {
@@ -1,6 +1,7 @@
 #include "fs/bio.h"
 #include "dev/virtio_disk.h"
 #include "lib/print.h"
+#include "memlayout.h"
 
 #define NBUF 32// number of buffer cache blocks,8 to test
 
@@ -121,3 +122,9 @@ void bunpin(struct buf *b)
     b->refcnt--;
     spinlock_release(&bcache.lock);
 }
+
+// bio_mem_pages: 块缓存占用的页数 (静态数组, 属于内核映像)
+uint32 bio_mem_pages(void)
+{
+    return (sizeof(bcache) + PGSIZE - 1) / PGSIZE;
+}
@@ -4,40 +4,36 @@
 #include "fs/pipe.h"
 #include "dev/uart.h"
 #include "lib/print.h"
+#include "lib/string.h"
+#include "mem/kmalloc.h"
 
-#define NFILE 32
-
+// 打开文件表不再是固定大小的数组, struct file 按需从 slab cache 分配
 static struct {
-    spinlock_t lock;
-    struct file file[NFILE];
+    spinlock_t lock;     // 保护各 file 的引用计数
+    kmem_cache_t *cache;
+    int nfile;           // 当前打开的 file 数
 } ftable;
 
 void fileinit(void)
 {
     spinlock_init(&ftable.lock, "ftable");
-    for (int i = 0; i < NFILE; i++) {
-        ftable.file[i].type = FD_NONE;
-        ftable.file[i].ref = 0;
-        ftable.file[i].readable = 0;
-        ftable.file[i].writable = 0;
-        ftable.file[i].off = 0;
-        ftable.file[i].ip = 0;
-        ftable.file[i].pipe = 0;
-    }
+    ftable.cache = kmem_cache_create("file", sizeof(struct file));
+    ftable.nfile = 0;
 }
 
 struct file* filealloc(void)
 {
-    spinlock_acquire(&ftable.lock);
-    for (int i = 0; i < NFILE; i++) {
-        if (ftable.file[i].ref == 0) {
-            ftable.file[i].ref = 1;
-            spinlock_release(&ftable.lock);
-            return &ftable.file[i];
-        }
+    struct file *f = (struct file*)kmem_cache_alloc(ftable.cache);
+    if (!f) {
+        return 0;
     }
+    memset(f, 0, sizeof(*f));
+    f->type = FD_NONE;
+    f->ref = 1;
+    spinlock_acquire(&ftable.lock);
+    ftable.nfile++;
     spinlock_release(&ftable.lock);
-    return 0;
+    return f;
 }
 
 struct file* filedup(struct file *f)
@@ -61,21 +57,19 @@ void fileclose(struct file *f)
         spinlock_release(&ftable.lock);
         return;
     }
-    f->type = FD_NONE;
-    f->readable = 0;
-    f->writable = 0;
-    f->off = 0;
+    ftable.nfile--;
+    spinlock_release(&ftable.lock);
+
     struct inode *ip = f->ip;
     struct pipe *pi = f->pipe;
-    f->ip = 0;
-    f->pipe = 0;
-    spinlock_release(&ftable.lock);
+    int writable = f->writable;
+    kmem_cache_free(ftable.cache, f);
 
     if (ip) {
         iput(ip);
     }
     if (pi) {
-        pipeclose(pi, f->writable);
+        pipeclose(pi, writable);
     }
 }
 
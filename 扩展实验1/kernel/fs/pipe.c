@@ -1,7 +1,7 @@
 #include "fs/pipe.h"
 #include "fs/file.h"
 #include "lib/string.h"
-#include "mem/pmem.h"
+#include "mem/kmalloc.h"
 #include "proc/proc.h"
 
 #define PIPESIZE 512
@@ -15,9 +15,17 @@ struct pipe {
     int writeopen;
 };
 
+// struct pipe 只有几百字节, 从专用的 slab cache 分配, 一页可以放下多个
+static kmem_cache_t *pipe_cache;
+
+void pipeinit(void)
+{
+    pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe));
+}
+
 static struct pipe* pipealloc_struct(void)
 {
-    struct pipe *pi = (struct pipe*)pmem_alloc(true);
+    struct pipe *pi = (struct pipe*)kmem_cache_alloc(pipe_cache);
     if (!pi)
         return 0;
     memset(pi, 0, sizeof(*pi));
@@ -65,7 +73,7 @@ bad:
         *f1 = 0;
     }
     if (pi) {
-        pmem_free((uint64)pi, true);
+        kmem_cache_free(pipe_cache, pi);
     }
     return -1;
 }
@@ -87,7 +95,7 @@ void pipeclose(struct pipe *pi, int writable)
     int writeopen = pi->writeopen;
     spinlock_release(&pi->lock);
     if (!readopen && !writeopen) {
-        pmem_free((uint64)pi, true);
+        kmem_cache_free(pipe_cache, pi);
     }
 }
 
@@ -137,3 +145,11 @@ int piperead(struct pipe *pi, char *addr, int n)
     spinlock_release(&pi->lock);
     return i;
 }
+
+// pipe_mem_pages: 管道对象占用的 slab 页数
+uint32 pipe_mem_pages(void)
+{
+    kmem_cache_stat_t st;
+    kmem_cache_stat(pipe_cache, &st);
+    return st.nr_slabs * st.slab_pages;
+}
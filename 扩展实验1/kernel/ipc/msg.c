@@ -1,54 +1,69 @@
 #include "ipc/msg.h"
 #include "lib/string.h"
+#include "mem/kmalloc.h"
 #include "proc/proc.h"
 
-static struct msgqueue queues[MSG_MAX_QUEUES];
+// 消息队列按需从 slab cache 分配并串成链表, 总数不超过 MSG_MAX_QUEUES
+static struct {
+    spinlock_t lock;          // 保护链表和 next_qid
+    kmem_cache_t *cache;
+    struct msgqueue *head;
+    int next_qid;             // 也就是已创建的队列数, 不超过 MSG_MAX_QUEUES
+} msgtable;
 
 void msg_init(void)
 {
-    for (int i = 0; i < MSG_MAX_QUEUES; i++) {
-        spinlock_init(&queues[i].lock, "msgq");
-        queues[i].used = 0;
-        queues[i].key = 0;
-        queues[i].head = queues[i].tail = queues[i].count = 0;
-        memset(queues[i].msgs, 0, sizeof(queues[i].msgs));
-    }
+    spinlock_init(&msgtable.lock, "msgtable");
+    msgtable.cache = kmem_cache_create("msgqueue", sizeof(struct msgqueue));
+    msgtable.head = NULL;
+    msgtable.next_qid = 0;
 }
 
 static struct msgqueue* get_queue(int qid)
 {
-    if (qid < 0 || qid >= MSG_MAX_QUEUES)
+    if (qid < 0)
         return NULL;
-    return &queues[qid];
+    spinlock_acquire(&msgtable.lock);
+    struct msgqueue *q = msgtable.head;
+    while (q && q->qid != qid) {
+        q = q->next;
+    }
+    spinlock_release(&msgtable.lock);
+    return q;
 }
 
 int msg_get(int key)
 {
+    spinlock_acquire(&msgtable.lock);
     // Try to find existing queue with same key
-    for (int i = 0; i < MSG_MAX_QUEUES; i++) {
-        struct msgqueue *q = &queues[i];
-        spinlock_acquire(&q->lock);
-        if (q->used && q->key == key) {
-            spinlock_release(&q->lock);
-            return i;
+    for (struct msgqueue *q = msgtable.head; q; q = q->next) {
+        if (q->key == key) {
+            int qid = q->qid;
+            spinlock_release(&msgtable.lock);
+            return qid;
         }
-        spinlock_release(&q->lock);
     }
 
     // Allocate a new one
-    for (int i = 0; i < MSG_MAX_QUEUES; i++) {
-        struct msgqueue *q = &queues[i];
-        spinlock_acquire(&q->lock);
-        if (!q->used) {
-            q->used = 1;
-            q->key = key;
-            q->head = q->tail = q->count = 0;
-            spinlock_release(&q->lock);
-            return i;
-        }
-        spinlock_release(&q->lock);
+    if (msgtable.next_qid >= MSG_MAX_QUEUES) {
+        spinlock_release(&msgtable.lock);
+        return -1;
+    }
+    struct msgqueue *q = (struct msgqueue*)kmem_cache_alloc(msgtable.cache);
+    if (!q) {
+        spinlock_release(&msgtable.lock);
+        return -1;
     }
-    return -1;
+    spinlock_init(&q->lock, "msgq");
+    q->used = 1;
+    q->key = key;
+    q->qid = msgtable.next_qid++;
+    q->head = q->tail = q->count = 0;
+    q->next = msgtable.head;
+    msgtable.head = q;
+    int qid = q->qid;
+    spinlock_release(&msgtable.lock);
+    return qid;
 }
 
 int msg_send(int qid, const char *data, int len)
@@ -0,0 +1,229 @@
+#include "ipc/shm.h"
+#include "lib/print.h"
+#include "lib/string.h"
+#include "mem/kmalloc.h"
+#include "mem/mmap.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "memlayout.h"
+#include "proc/proc.h"
+
+// 共享内存段和消息队列一样从 slab cache 分配并串成链表
+static struct {
+    spinlock_t lock;          // 保护链表, next_id, nsegs 和各段的 nattch
+    kmem_cache_t *cache;
+    struct shmseg *head;
+    int next_id;
+    int nsegs;                // 链表中的段数, 不超过 SHM_MAX_SEGS
+} shmtable;
+
+void shm_init(void)
+{
+    spinlock_init(&shmtable.lock, "shmtable");
+    shmtable.cache = kmem_cache_create("shmseg", sizeof(struct shmseg));
+    shmtable.head = NULL;
+    shmtable.next_id = 0;
+    shmtable.nsegs = 0;
+}
+
+// 调用者持有 shmtable.lock
+static struct shmseg* find_key(int key)
+{
+    for (struct shmseg *s = shmtable.head; s; s = s->next) {
+        if (s->key == key) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static struct shmseg* find_id(int id)
+{
+    for (struct shmseg *s = shmtable.head; s; s = s->next) {
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void seg_free(struct shmseg *s)
+{
+    for (uint32 i = 0; i < s->npages; i++) {
+        if (s->pages[i]) {
+            pmem_free(s->pages[i], false);
+        }
+    }
+    kfree(s->pages);
+    kmem_cache_free(shmtable.cache, s);
+}
+
+// 分配一个新段及其全部页面, 可能因为回收内存而睡眠, 不能持有 shmtable.lock
+static struct shmseg* seg_alloc(int key, uint64 size)
+{
+    struct shmseg *s = (struct shmseg*)kmem_cache_alloc(shmtable.cache);
+    if (s == NULL) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->key = key;
+    s->size = size;
+    s->npages = size / PGSIZE;
+    s->pages = (uint64*)kmalloc(s->npages * sizeof(uint64));
+    if (s->pages == NULL) {
+        kmem_cache_free(shmtable.cache, s);
+        return NULL;
+    }
+    memset(s->pages, 0, s->npages * sizeof(uint64));
+    for (uint32 i = 0; i < s->npages; i++) {
+        void *mem = uvm_alloc_page(true);
+        if (mem == NULL) {
+            seg_free(s);
+            return NULL;
+        }
+        s->pages[i] = (uint64)mem;
+    }
+    return s;
+}
+
+// shm_get: 返回 key 对应的段, 不存在时创建一个 size 字节的新段
+// 已有的段比请求的小, 或者段数已经达到 SHM_MAX_SEGS 时失败
+int shm_get(int key, uint64 size)
+{
+    if (size == 0 || size > SHM_MAX_SIZE) {
+        return -1;
+    }
+    size = PG_ROUND_UP(size);
+
+    spinlock_acquire(&shmtable.lock);
+    struct shmseg *s = find_key(key);
+    if (s) {
+        int id = s->size >= size ? s->id : -1;
+        spinlock_release(&shmtable.lock);
+        return id;
+    }
+    // 先检查一次, 不为注定失败的段分配页面; 插入时还要再检查
+    bool full = shmtable.nsegs >= SHM_MAX_SEGS;
+    spinlock_release(&shmtable.lock);
+    if (full) {
+        return -1;
+    }
+
+    struct shmseg *ns = seg_alloc(key, size);
+    if (ns == NULL) {
+        return -1;
+    }
+    spinlock_acquire(&shmtable.lock);
+    if ((s = find_key(key)) != NULL) {
+        // 分配期间别的进程已经用同一个 key 建好了段
+        int id = s->size >= size ? s->id : -1;
+        spinlock_release(&shmtable.lock);
+        seg_free(ns);
+        return id;
+    }
+    if (shmtable.nsegs >= SHM_MAX_SEGS) {
+        spinlock_release(&shmtable.lock);
+        seg_free(ns);
+        return -1;
+    }
+    ns->id = shmtable.next_id++;
+    ns->creator = myproc() ? myproc()->pid : 0;
+    ns->next = shmtable.head;
+    shmtable.head = ns;
+    shmtable.nsegs++;
+    int id = ns->id;
+    spinlock_release(&shmtable.lock);
+    return id;
+}
+
+void shm_dup(struct shmseg *seg)
+{
+    spinlock_acquire(&shmtable.lock);
+    seg->nattch++;
+    spinlock_release(&shmtable.lock);
+}
+
+// shm_put: 一个映射不再引用本段; 最后一个映射解除时把段从 key 空间中移除并释放
+void shm_put(struct shmseg *seg)
+{
+    spinlock_acquire(&shmtable.lock);
+    if (seg->nattch <= 0) {
+        panic("shm_put");
+    }
+    if (--seg->nattch > 0) {
+        spinlock_release(&shmtable.lock);
+        return;
+    }
+    struct shmseg **pp = &shmtable.head;
+    while (*pp != seg) {
+        pp = &(*pp)->next;
+    }
+    *pp = seg->next;
+    shmtable.nsegs--;
+    spinlock_release(&shmtable.lock);
+    seg_free(seg);
+}
+
+// shm_exit: 进程退出时销毁它创建而当前没有任何映射的段
+// 调用者已经解除了进程自己的映射; 还有别的进程映射着的段仍由最后一个 shm_put 销毁
+void shm_exit(struct proc *p)
+{
+    struct shmseg *dead = NULL;
+    spinlock_acquire(&shmtable.lock);
+    struct shmseg **pp = &shmtable.head;
+    while (*pp) {
+        struct shmseg *s = *pp;
+        if (s->creator == p->pid && s->nattch == 0) {
+            *pp = s->next;
+            shmtable.nsegs--;
+            s->next = dead;
+            dead = s;
+        } else {
+            pp = &s->next;
+        }
+    }
+    spinlock_release(&shmtable.lock);
+    while (dead) {
+        struct shmseg *s = dead;
+        dead = s->next;
+        seg_free(s);
+    }
+}
+
+uint64 shm_page(struct shmseg *seg, uint64 idx)
+{
+    if (idx >= seg->npages) {
+        panic("shm_page");
+    }
+    return seg->pages[idx];
+}
+
+// shm_attach: 把段映射进进程, 返回起始地址, 失败返回 -1
+uint64 shm_attach(struct proc *p, int shmid)
+{
+    spinlock_acquire(&shmtable.lock);
+    struct shmseg *s = find_id(shmid);
+    if (s == NULL) {
+        spinlock_release(&shmtable.lock);
+        return (uint64)-1;
+    }
+    // 先为新映射取得引用, 防止段在建立映射的过程中被销毁
+    s->nattch++;
+    spinlock_release(&shmtable.lock);
+
+    uint64 va = mmap_map_shm(p, s, s->size, PROT_READ | PROT_WRITE);
+    if (va == (uint64)-1) {
+        shm_put(s);
+    }
+    return va;
+}
+
+// shm_detach: 解除从 addr 开始的共享内存映射
+int shm_detach(struct proc *p, uint64 addr)
+{
+    struct vma *v = mmap_find(p, addr);
+    if (v == NULL || v->shm == NULL || v->start != addr) {
+        return -1;
+    }
+    return mmap_unmap(p, v->start, v->end - v->start);
+}
@@ -1,26 +1,50 @@
 #include "lib/klog.h"
 #include "lib/lock.h"
 #include "lib/string.h"
+#include "mem/vmalloc.h"
 #include <stdarg.h>
 
 struct klog_buffer klog_buf;
+static char klog_boot_buf[LOG_BUF_SIZE];
 
 void klog_init(void)
 {
     spinlock_init(&klog_buf.lock, "klog");
+    klog_buf.buf = klog_boot_buf;
+    klog_buf.size = LOG_BUF_SIZE;
     klog_buf.read_pos = 0;
     klog_buf.write_pos = 0;
     klog_buf.level = LOG_LEVEL_INFO;
     klog_buf.dropped = 0;
 }
 
+// klog_enlarge: vmalloc 可用之后换成 LOG_VBUF_SIZE 字节的缓冲区, 保留还没读出的内容
+void klog_enlarge(void)
+{
+    char *nbuf = vmalloc(LOG_VBUF_SIZE);
+    if (nbuf == NULL) {
+        return;
+    }
+    spinlock_acquire(&klog_buf.lock);
+    int n = 0;
+    while (klog_buf.read_pos != klog_buf.write_pos) {
+        nbuf[n++] = klog_buf.buf[klog_buf.read_pos];
+        klog_buf.read_pos = (klog_buf.read_pos + 1) % klog_buf.size;
+    }
+    klog_buf.buf = nbuf;
+    klog_buf.size = LOG_VBUF_SIZE;
+    klog_buf.read_pos = 0;
+    klog_buf.write_pos = n;
+    spinlock_release(&klog_buf.lock);
+}
+
 static void klog_write_bytes(const char *buf, int len)
 {
     for (int i = 0; i < len; i++) {
         klog_buf.buf[klog_buf.write_pos] = buf[i];
-        klog_buf.write_pos = (klog_buf.write_pos + 1) % LOG_BUF_SIZE;
+        klog_buf.write_pos = (klog_buf.write_pos + 1) % klog_buf.size;
         if (klog_buf.write_pos == klog_buf.read_pos) {
-            klog_buf.read_pos = (klog_buf.read_pos + 1) % LOG_BUF_SIZE;
+            klog_buf.read_pos = (klog_buf.read_pos + 1) % klog_buf.size;
             klog_buf.dropped++;
         }
     }
@@ -123,7 +147,7 @@ int klog_read(char *dst, int n)
     if (klog_buf.write_pos >= klog_buf.read_pos) {
         available = klog_buf.write_pos - klog_buf.read_pos;
     } else {
-        available = LOG_BUF_SIZE - klog_buf.read_pos + klog_buf.write_pos;
+        available = klog_buf.size - klog_buf.read_pos + klog_buf.write_pos;
     }
 
     if (available == 0) {
@@ -134,9 +158,9 @@ int klog_read(char *dst, int n)
         n = available;
     }
     for (int i = 0; i < n; i++) {
-        dst[i] = klog_buf.buf[(klog_buf.read_pos + i) % LOG_BUF_SIZE];
+        dst[i] = klog_buf.buf[(klog_buf.read_pos + i) % klog_buf.size];
     }
-    klog_buf.read_pos = (klog_buf.read_pos + n) % LOG_BUF_SIZE;
+    klog_buf.read_pos = (klog_buf.read_pos + n) % klog_buf.size;
     spinlock_release(&klog_buf.lock);
     return n;
 }
@@ -0,0 +1,373 @@
+#include "mem/kmalloc.h"
+#include "mem/pmem.h"
+#include "lib/lock.h"
+#include "lib/print.h"
+#include "lib/string.h"
+#include "memlayout.h"
+#include "proc/proc.h"
+
+#define KMEM_MAX_CACHES 24
+#define KMEM_ALIGN      16
+#define KMEM_CPU_OBJS   16          // 每个CPU对象缓存的容量
+#define KMEM_CPU_BATCH  8           // 每次批量补充/归还的对象数
+#define SLAB_MAGIC      0x534c4142u // "SLAB"
+#define SLAB_MAX_ORDER  3           // 大对象的 slab 最多 8 页
+
+#define KMEM_ROUND_UP(x) (((x) + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1))
+
+// 空闲对象内部存放的链表节点
+typedef struct obj_node {
+    struct obj_node* next;
+} obj_node_t;
+
+// slab 头, 位于每个 slab 页(或大块分配的首页)的开头
+typedef struct slab {
+    struct slab* next;
+    struct slab* prev;
+    kmem_cache_t* cache;     // 所属 cache, kmalloc 大块分配时为 NULL
+    uint32 magic;
+    uint32 order;            // slab (或大块分配) 的阶
+    uint32 inuse;            // 已分配出去的对象数
+    obj_node_t* freelist;    // 本 slab 内的空闲对象
+} slab_t;
+
+#define SLAB_HDR KMEM_ROUND_UP(sizeof(slab_t))
+
+// 每个CPU的对象缓存, 只由对应CPU在关中断时访问
+typedef struct kmem_cpu_cache {
+    uint32 avail;
+    void* objs[KMEM_CPU_OBJS];
+    uint64 hits;
+} kmem_cpu_cache_t;
+
+struct kmem_cache {
+    spinlock_t lock;         // 保护 slab 链表和计数
+    char name[16];
+    uint32 obj_size;
+    uint32 objs_per_slab;
+    uint32 order;            // 每个 slab 占 2^order 页
+    slab_t partial;          // 还有空闲对象的 slab (哨兵节点)
+    slab_t full;             // 对象已全部分配的 slab (哨兵节点)
+    uint32 nr_slabs;
+    uint32 nr_empty;         // partial 中完全空闲的 slab 数
+    uint32 inuse;            // 从 slab 中取出的对象数 (包括留在CPU缓存中的)
+    kmem_cpu_cache_t cpu[NCPU];
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static int ncaches;
+static spinlock_t caches_lock;
+
+// kmalloc 的 size class
+static const uint32 kmalloc_sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define KMALLOC_NCLASS (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+static kmem_cache_t* kmalloc_caches[KMALLOC_NCLASS];
+static const char* kmalloc_names[KMALLOC_NCLASS] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static inline void slab_list_init(slab_t* head)
+{
+    head->next = head->prev = head;
+}
+
+static inline void slab_list_add(slab_t* head, slab_t* s)
+{
+    s->next = head->next;
+    s->prev = head;
+    head->next->prev = s;
+    head->next = s;
+}
+
+static inline void slab_list_del(slab_t* s)
+{
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+// obj_to_slab: 对象所在 slab 的头部; 多页 slab 中的对象先按页元数据找回首页
+static inline slab_t* obj_to_slab(void* obj)
+{
+    uint64 page = PG_ROUND_DOWN((uint64)obj);
+    slab_t* s = (slab_t*)(page - (uint64)pmem_slab_index(page) * PGSIZE);
+    if (s->magic != SLAB_MAGIC) {
+        panic("kmem: object does not belong to a slab");
+    }
+    return s;
+}
+
+void kmem_init(void)
+{
+    spinlock_init(&caches_lock, "kmem_caches");
+    ncaches = 0;
+    for (uint32 i = 0; i < KMALLOC_NCLASS; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], kmalloc_sizes[i]);
+    }
+}
+
+// slab_order: 对象大于 PGSIZE/8 时单页 slab 的尾部浪费太多 (2048 字节的对象一页只放得下一个),
+// 改用多页 slab: 取浪费不超过 1/8 的最小阶, 都不满足时用 SLAB_MAX_ORDER
+static uint32 slab_order(uint32 obj_size)
+{
+    if (obj_size <= PGSIZE / 8) {
+        return 0;
+    }
+    for (uint32 order = 0; order < SLAB_MAX_ORDER; order++) {
+        uint64 bytes = (uint64)PGSIZE << order;
+        if (bytes - SLAB_HDR >= obj_size && ((bytes - SLAB_HDR) % obj_size) * 8 <= bytes) {
+            return order;
+        }
+    }
+    return SLAB_MAX_ORDER;
+}
+
+// kmem_cache_create: 创建一个对象大小为 size 的 cache
+kmem_cache_t* kmem_cache_create(const char* name, uint32 size)
+{
+    uint32 obj_size = KMEM_ROUND_UP(size);
+    if (obj_size < sizeof(obj_node_t)) {
+        obj_size = KMEM_ROUND_UP(sizeof(obj_node_t));
+    }
+    if (obj_size > (PGSIZE << SLAB_MAX_ORDER) - SLAB_HDR) {
+        panic("kmem_cache_create: object too large for a slab");
+    }
+
+    spinlock_acquire(&caches_lock);
+    if (ncaches >= KMEM_MAX_CACHES) {
+        spinlock_release(&caches_lock);
+        panic("kmem_cache_create: too many caches");
+    }
+    kmem_cache_t* cache = &caches[ncaches++];
+    spinlock_release(&caches_lock);
+
+    memset(cache, 0, sizeof(*cache));
+    safestrcpy(cache->name, name, sizeof(cache->name));
+    spinlock_init(&cache->lock, cache->name);
+    cache->obj_size = obj_size;
+    cache->order = slab_order(obj_size);
+    cache->objs_per_slab = ((PGSIZE << cache->order) - SLAB_HDR) / obj_size;
+    slab_list_init(&cache->partial);
+    slab_list_init(&cache->full);
+    return cache;
+}
+
+// slab_grow: 申请 2^order 页作为新的 slab, 切分成空闲对象 (调用者持有 cache 锁)
+// 单页 slab 走 pmem_alloc 的每CPU缓存; 多页 slab 在每一页的元数据中记下它是第几页
+static slab_t* slab_grow(kmem_cache_t* cache)
+{
+    slab_t* s = (slab_t*)(cache->order ? pmem_alloc_order(cache->order, true) : pmem_alloc(true));
+    if (s == NULL) {
+        return NULL;
+    }
+    for (uint32 i = 1; i < (1u << cache->order); i++) {
+        pmem_set_slab_index((uint64)s + (uint64)i * PGSIZE, i);
+    }
+    s->cache = cache;
+    s->magic = SLAB_MAGIC;
+    s->order = cache->order;
+    s->inuse = 0;
+    s->freelist = NULL;
+    uint8* base = (uint8*)s + SLAB_HDR;
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+        obj_node_t* node = (obj_node_t*)(base + (uint64)i * cache->obj_size);
+        node->next = s->freelist;
+        s->freelist = node;
+    }
+    slab_list_add(&cache->partial, s);
+    cache->nr_slabs++;
+    cache->nr_empty++;
+    return s;
+}
+
+// cache_take: 从 slab 中取出至多 n 个对象 (调用者持有 cache 锁)
+static int cache_take(kmem_cache_t* cache, int n, void* objs[])
+{
+    int taken = 0;
+    while (taken < n) {
+        slab_t* s = cache->partial.next;
+        if (s == &cache->partial) {
+            s = slab_grow(cache);
+            if (s == NULL) {
+                break;
+            }
+        }
+        obj_node_t* obj = s->freelist;
+        s->freelist = obj->next;
+        if (s->inuse++ == 0) {
+            cache->nr_empty--;
+        }
+        if (s->freelist == NULL) {
+            slab_list_del(s);
+            slab_list_add(&cache->full, s);
+        }
+        cache->inuse++;
+        objs[taken++] = obj;
+    }
+    return taken;
+}
+
+// cache_put: 把 n 个对象还给各自的 slab, 多余的空 slab 还给 pmem (调用者持有 cache 锁)
+static void cache_put(kmem_cache_t* cache, int n, void* objs[])
+{
+    for (int i = 0; i < n; i++) {
+        slab_t* s = obj_to_slab(objs[i]);
+        obj_node_t* obj = (obj_node_t*)objs[i];
+        if (s->freelist == NULL) {
+            slab_list_del(s);
+            slab_list_add(&cache->partial, s);
+        }
+        obj->next = s->freelist;
+        s->freelist = obj;
+        cache->inuse--;
+        if (--s->inuse == 0) {
+            cache->nr_empty++;
+            // 保留一个空 slab 以免在边界上反复申请/释放页面
+            if (cache->nr_empty > 1) {
+                slab_list_del(s);
+                s->magic = 0;
+                cache->nr_slabs--;
+                cache->nr_empty--;
+                if (s->order) {
+                    pmem_free_order((uint64)s, s->order, true);
+                } else {
+                    pmem_free((uint64)s, true);
+                }
+            }
+        }
+    }
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+    void* obj = NULL;
+
+    push_off();
+    kmem_cpu_cache_t* cc = &cache->cpu[mycpuid()];
+    if (cc->avail > 0) {
+        cc->hits++;
+    } else {
+        spinlock_acquire(&cache->lock);
+        cc->avail = cache_take(cache, KMEM_CPU_BATCH, cc->objs);
+        spinlock_release(&cache->lock);
+    }
+    if (cc->avail > 0) {
+        obj = cc->objs[--cc->avail];
+    }
+    pop_off();
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj)
+{
+    if (obj == NULL) {
+        return;
+    }
+    if (obj_to_slab(obj)->cache != cache) {
+        panic("kmem_cache_free: object freed to wrong cache");
+    }
+
+    push_off();
+    kmem_cpu_cache_t* cc = &cache->cpu[mycpuid()];
+    if (cc->avail == KMEM_CPU_OBJS) {
+        // CPU缓存已满: 把最早的一批对象还给 slab
+        spinlock_acquire(&cache->lock);
+        cache_put(cache, KMEM_CPU_BATCH, cc->objs);
+        spinlock_release(&cache->lock);
+        memmove(cc->objs, cc->objs + KMEM_CPU_BATCH,
+                (KMEM_CPU_OBJS - KMEM_CPU_BATCH) * sizeof(void*));
+        cc->avail -= KMEM_CPU_BATCH;
+    }
+    cc->objs[cc->avail++] = obj;
+    pop_off();
+}
+
+void kmem_cache_stat(kmem_cache_t* cache, kmem_cache_stat_t* st)
+{
+    spinlock_acquire(&cache->lock);
+    st->name = cache->name;
+    st->obj_size = cache->obj_size;
+    st->objs_per_slab = cache->objs_per_slab;
+    st->slab_pages = 1u << cache->order;
+    st->nr_slabs = cache->nr_slabs;
+    st->inuse = cache->inuse;
+    spinlock_release(&cache->lock);
+    st->cpu_hits = 0;
+    for (int i = 0; i < NCPU; i++) {
+        st->inuse -= cache->cpu[i].avail;
+        st->cpu_hits += cache->cpu[i].hits;
+    }
+}
+
+// kmalloc: 小于等于 2048 字节的请求走对应的 size class,
+// 更大的请求从伙伴系统取连续页面, 首页开头同样放一个 slab 头用于 kfree 识别
+void* kmalloc(uint32 size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+    for (uint32 i = 0; i < KMALLOC_NCLASS; i++) {
+        if (size <= kmalloc_sizes[i]) {
+            return kmem_cache_alloc(kmalloc_caches[i]);
+        }
+    }
+
+    uint64 need = SLAB_HDR + (uint64)size;
+    int order = 0;
+    while (((uint64)PGSIZE << order) < need) {
+        order++;
+    }
+    if (order > PMEM_MAX_ORDER) {
+        return NULL;
+    }
+    slab_t* s = (slab_t*)pmem_alloc_order(order, true);
+    if (s == NULL) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->magic = SLAB_MAGIC;
+    s->order = order;
+    return (uint8*)s + SLAB_HDR;
+}
+
+void kfree(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    slab_t* s = obj_to_slab(ptr);
+    if (s->cache) {
+        kmem_cache_free(s->cache, ptr);
+    } else {
+        s->magic = 0;
+        pmem_free_order((uint64)s, s->order, true);
+    }
+}
+
+// kmem_slab_pages: 所有 cache 的 slab 占用的页数
+uint32 kmem_slab_pages(void)
+{
+    uint32 n = 0;
+    for (int i = 0; i < ncaches; i++) {
+        kmem_cache_stat_t st;
+        kmem_cache_stat(&caches[i], &st);
+        n += st.nr_slabs * st.slab_pages;
+    }
+    return n;
+}
+
+void kmem_print_stats(void)
+{
+    printf("\n=== KMEM slab caches ===\n");
+    for (int i = 0; i < ncaches; i++) {
+        kmem_cache_stat_t st;
+        kmem_cache_stat(&caches[i], &st);
+        if (st.nr_slabs == 0 && st.cpu_hits == 0) {
+            continue;
+        }
+        printf(" %s: size=%u per_slab=%u slab_pages=%u slabs=%u inuse=%u cpu_hits=%lu\n", st.name,
+               st.obj_size, st.objs_per_slab, st.slab_pages, st.nr_slabs, st.inuse, st.cpu_hits);
+    }
+    printf("========================\n");
+}
@@ -0,0 +1,222 @@
+#include "mem/ksm.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "lib/lock.h"
+#include "lib/print.h"
+#include "lib/string.h"
+#include "riscv.h"
+#include "proc/proc.h"
+
+#define KSM_STABLE_MAX 256
+#define KSM_UNSTABLE_SIZE 1024   // 直接映射, 必须是 2 的幂
+
+struct ksm_entry {
+    uint64 pa;
+    uint32 hash;
+};
+
+static struct {
+    spinlock_t lock;                 // 保护两张表和统计
+    struct ksm_entry stable[KSM_STABLE_MAX];
+    struct ksm_entry unstable[KSM_UNSTABLE_SIZE];
+    ksm_stat_t stat;
+} ksm;
+
+// 全局扫描代数, 只在 CPU 0 的时钟中断中递增
+static volatile uint64 ksm_epoch = 1;
+
+void ksm_init(void)
+{
+    spinlock_init(&ksm.lock, "ksm");
+}
+
+void ksm_tick(void)
+{
+    static int ticks;
+    if (++ticks >= KSM_SCAN_TICKS) {
+        ticks = 0;
+        ksm_epoch++;
+    }
+}
+
+// ksm_hash: FNV-1a 风格的页面哈希, 顺便判断是否全零
+static uint32 ksm_hash(uint64 pa, bool *zero)
+{
+    const uint64 *w = (const uint64*)pa;
+    uint64 h = 0xcbf29ce484222325ull;
+    uint64 any = 0;
+    for (int i = 0; i < PGSIZE / 8; i++) {
+        h = (h ^ w[i]) * 0x100000001b3ull;
+        any |= w[i];
+    }
+    *zero = (any == 0);
+    return (uint32)(h ^ (h >> 32));
+}
+
+// stable_find: 在稳定表中找内容与 pa 相同的页, 顺便释放只剩稳定表自己引用的页; 调用者持有 ksm.lock
+static uint64 stable_find(uint64 pa, uint32 hash)
+{
+    for (int i = 0; i < KSM_STABLE_MAX; i++) {
+        struct ksm_entry *e = &ksm.stable[i];
+        if (e->pa == 0) {
+            continue;
+        }
+        if (pmem_ref_count(e->pa) == 1) {
+            // 所有映射都已经写入 (取消合并) 或解除
+            pmem_free(e->pa, false);
+            e->pa = 0;
+            ksm.stat.stable--;
+            continue;
+        }
+        if (e->hash == hash && memcmp((void*)e->pa, (void*)pa, PGSIZE) == 0) {
+            return e->pa;
+        }
+    }
+    return 0;
+}
+
+static bool stable_add(uint64 pa, uint32 hash)
+{
+    for (int i = 0; i < KSM_STABLE_MAX; i++) {
+        if (ksm.stable[i].pa == 0) {
+            ksm.stable[i].pa = pa;
+            ksm.stable[i].hash = hash;
+            ksm.stat.stable++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 把 *pte 改为只读的写时复制映射, 指向 pa
+static void ksm_remap(pte_t *pte, uint64 pa)
+{
+    *pte = PA_TO_PTE(pa) | ((PTE_FLAGS(*pte) & ~(PTE_W | PTE_D)) | PTE_COW);
+}
+
+struct ksm_scan_args {
+    int budget;
+    uint64 next;       // 下一次从这里继续
+    bool changed;
+};
+
+static int ksm_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct ksm_scan_args *a = arg;
+    if (a->budget == 0) {
+        a->next = va;
+        return -1;
+    }
+    if (level != 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U) || (*pte & PTE_IMG) ||
+        !(*pte & (PTE_W | PTE_COW))) {
+        return 0;
+    }
+    uint64 pa = PTE_TO_PA(*pte);
+    if (pmem_owner(pa) != 0 || pmem_ref_count(pa) != 1) {
+        // 已经共享 (COW, 零页, 稳定页, 共享内存) 的页面不再处理
+        return 0;
+    }
+    a->budget--;
+    bool zero;
+    uint32 hash = ksm_hash(pa, &zero);
+
+    spinlock_acquire(&ksm.lock);
+    ksm.stat.scanned++;
+    if (zero) {
+        uint64 zp = uvm_zero_page();
+        pmem_ref_inc(zp);
+        ksm_remap(pte, zp);
+        ksm.stat.zero_merged++;
+        spinlock_release(&ksm.lock);
+        pmem_free(pa, false);
+        a->changed = true;
+        return 0;
+    }
+    uint64 spa = stable_find(pa, hash);
+    if (spa) {
+        pmem_ref_inc(spa);
+        ksm_remap(pte, spa);
+        ksm.stat.merged++;
+        spinlock_release(&ksm.lock);
+        pmem_free(pa, false);
+        a->changed = true;
+        return 0;
+    }
+    struct ksm_entry *u = &ksm.unstable[hash & (KSM_UNSTABLE_SIZE - 1)];
+    if (u->pa != 0 && u->pa != pa && u->hash == hash &&
+        memcmp((void*)u->pa, (void*)pa, PGSIZE) == 0 && stable_add(pa, hash)) {
+        // 另一页 (可能已经不在了, 只读它的内容) 与这一页相同: 这一页成为稳定页, 稳定表持有一个引用
+        pmem_ref_inc(pa);
+        ksm_remap(pte, pa);
+        u->pa = 0;
+        ksm.stat.promoted++;
+        a->changed = true;
+    } else {
+        u->pa = pa;
+        u->hash = hash;
+    }
+    spinlock_release(&ksm.lock);
+    return 0;
+}
+
+// ksm_scan: 进程返回用户态之前调用, 每个扫描周期从上次停下的地方继续扫描一批页面
+void ksm_scan(struct proc *p)
+{
+#ifdef VM_NO_KSM
+    (void)p;
+#else
+    uint64 epoch = ksm_epoch;
+    if (p->ksm_epoch == epoch || p->pagetable == NULL) {
+        return;
+    }
+    p->ksm_epoch = epoch;
+    uint64 end = PG_ROUND_UP(p->sz);
+    if (p->ksm_next >= end) {
+        p->ksm_next = 0;
+    }
+    uint64 start = r_time();
+    struct ksm_scan_args a = { KSM_SCAN_BATCH, 0, false };
+    // 释放页面时持有 p->lock, 和 memstat 等遍历页表的观察者互斥
+    spinlock_acquire(&p->lock);
+    if (vm_range_walk(p->pagetable, p->ksm_next, end, 0, ksm_leaf, &a) < 0) {
+        p->ksm_next = a.next;
+    } else {
+        p->ksm_next = 0;
+    }
+    if (a.changed) {
+        uvm_tlb_flush(p);
+    }
+    spinlock_release(&p->lock);
+    uint64 spent = r_time() - start;
+    spinlock_acquire(&ksm.lock);
+    ksm.stat.scans++;
+    ksm.stat.ticks += spent;
+    spinlock_release(&ksm.lock);
+#endif
+}
+
+void ksm_get_stat(ksm_stat_t *st)
+{
+    spinlock_acquire(&ksm.lock);
+    *st = ksm.stat;
+    st->sharing = 0;
+    for (int i = 0; i < KSM_STABLE_MAX; i++) {
+        if (ksm.stable[i].pa) {
+            // 引用 = 映射数 + 稳定表自己的一个
+            uint32 maps = pmem_ref_count(ksm.stable[i].pa) - 1;
+            if (maps > 1) {
+                st->sharing += maps - 1;
+            }
+        }
+    }
+    spinlock_release(&ksm.lock);
+}
+
+void ksm_print_stats(void)
+{
+    ksm_stat_t st;
+    ksm_get_stat(&st);
+    printf("[ksm] scans=%llu scanned=%llu merged=%llu zero_merged=%llu promoted=%llu\n",
+           st.scans, st.scanned, st.merged, st.zero_merged, st.promoted);
+    printf("[ksm] stable=%u sharing=%u cpu_ns=%llu\n", st.stable, st.sharing, st.ticks * 100);
+}
@@ -0,0 +1,82 @@
+#include "mem/memstat.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "mem/kmalloc.h"
+#include "mem/swap.h"
+#include "mem/ksm.h"
+#include "fs/bio.h"
+#include "fs/pipe.h"
+#include "lib/string.h"
+#include "proc/proc.h"
+
+// 进程自己持有的内核页: 内核栈和 trapframe 各一页
+static uint32 proc_kernel_pages(struct proc *p)
+{
+    return (p->kstack ? 1 : 0) + (p->trapframe ? 1 : 0);
+}
+
+void memstat_system(struct memstat_sys *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->image_pages = pmem_image_pages();
+    st->bcache_pages = bio_mem_pages();
+    st->total_pages = pmem_total_pages();
+    st->kernel_pages = pmem_used_pages_count(true);
+    st->user_pages = pmem_used_pages_count(false);
+    st->free_pages = st->total_pages - st->kernel_pages - st->user_pages;
+    st->pgtbl_pages = (uint32)vm_pgtbl_pages();
+    st->slab_pages = kmem_slab_pages();
+    st->pipe_pages = pipe_mem_pages();
+    for (int i = 0; i < NPROC; i++) {
+        struct proc *p = &proc_table[i];
+        spinlock_acquire(&p->lock);
+        if (p->state != PROC_UNUSED) {
+            st->nproc++;
+            st->proc_pages += proc_kernel_pages(p);
+        }
+        spinlock_release(&p->lock);
+    }
+    st->nproc_max = NPROC;
+    swap_stat_t ss;
+    swap_get_stat(&ss);
+    st->swap_slots = ss.nslots;
+    st->swap_used = ss.used;
+    st->zero_maps = (uint32)uvm_zero_mappings();
+    ksm_stat_t ks;
+    ksm_get_stat(&ks);
+    st->ksm_shared = ks.stable;
+    st->ksm_sharing = ks.sharing;
+}
+
+int memstat_proc(int slot, struct memstat_proc *st)
+{
+    if (slot < 0 || slot >= NPROC) {
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    struct proc *p = &proc_table[slot];
+    spinlock_acquire(&p->lock);
+    if (p->state == PROC_UNUSED) {
+        spinlock_release(&p->lock);
+        return 0;
+    }
+    st->pid = p->pid;
+    st->state = p->state;
+    memmove(st->name, p->name, sizeof(st->name));
+    st->name[sizeof(st->name) - 1] = 0;
+    st->sz = p->sz;
+    st->kernel_pages = proc_kernel_pages(p);
+    st->minflt = p->min_flt;
+    st->majflt = p->maj_flt;
+    st->ws = p->ws;
+    if (p->pagetable) {
+        uvm_usage_t u;
+        uvm_usage(p->pagetable, &u);
+        st->rss = u.resident;
+        st->shared = u.shared;
+        st->swapped = u.swapped;
+        st->pgtbl_pages = u.pgtbl;
+    }
+    spinlock_release(&p->lock);
+    return 1;
+}
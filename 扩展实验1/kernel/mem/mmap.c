@@ -0,0 +1,512 @@
+#include "mem/mmap.h"
+#include "mem/kmalloc.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "fs/file.h"
+#include "fs/fs.h"
+#include "fs/log.h"
+#include "ipc/shm.h"
+#include "lib/print.h"
+#include "lib/string.h"
+#include "memlayout.h"
+#include "proc/proc.h"
+
+// 一次写回事务最多写入的字节数, 与 filewrite 的分块大小保持一致
+#define MMAP_WB_CHUNK (((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE)
+
+static kmem_cache_t *vma_cache;
+
+void mmap_init(void)
+{
+    vma_cache = kmem_cache_create("vma", sizeof(struct vma));
+}
+
+static struct vma* vma_alloc(void)
+{
+    struct vma *v = (struct vma*)kmem_cache_alloc(vma_cache);
+    if (v) {
+        memset(v, 0, sizeof(*v));
+    }
+    return v;
+}
+
+static void vma_free(struct vma *v)
+{
+    if (v->file) {
+        fileclose(v->file);
+    }
+    if (v->shm) {
+        shm_put(v->shm);
+    }
+    kmem_cache_free(vma_cache, v);
+}
+
+// 按起始地址升序插入
+static void vma_insert(struct proc *p, struct vma *v)
+{
+    struct vma **pp = &p->vmas;
+    while (*pp && (*pp)->start < v->start) {
+        pp = &(*pp)->next;
+    }
+    v->next = *pp;
+    *pp = v;
+}
+
+struct vma* mmap_find(struct proc *p, uint64 va)
+{
+    for (struct vma *v = p->vmas; v; v = v->next) {
+        if (va < v->start) {
+            break;
+        }
+        if (va < v->end) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+// mmap_floor: 堆 (sbrk) 可以增长到的上界
+uint64 mmap_floor(struct proc *p)
+{
+    return p->vmas ? p->vmas->start : TRAPFRAME;
+}
+
+// 在 [PG_ROUND_UP(p->sz), MMAP_TOP) 中找一段能放下 len 的空闲区间, 取最高的那一段
+static uint64 vma_find_gap(struct proc *p, uint64 len)
+{
+    uint64 best = 0;
+    uint64 lo = PG_ROUND_UP(p->sz);
+    struct vma *v = p->vmas;
+    for (;;) {
+        uint64 hi = v ? v->start : MMAP_TOP;
+        if (hi > MMAP_TOP) {
+            hi = MMAP_TOP;
+        }
+        if (hi > lo && hi - lo >= len) {
+            best = hi - len;
+        }
+        if (v == NULL) {
+            break;
+        }
+        if (v->end > lo) {
+            lo = v->end;
+        }
+        v = v->next;
+    }
+    return best;
+}
+
+// 把共享文件映射里的一个脏页写回文件, 只覆盖文件已有的长度, 不会扩展文件
+static int writeback_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct vma *v = arg;
+    if (level != 0 || (*pte & PTE_D) == 0) {
+        return 0;
+    }
+    struct inode *ip = v->file->ip;
+    uint64 pa = PTE_TO_PA(*pte);
+    uint64 off = v->off + (va - v->start);
+    for (uint32 done = 0; done < PGSIZE;) {
+        begin_op();
+        ilock(ip);
+        if (off + done >= ip->size) {
+            iunlock(ip);
+            end_op();
+            break;
+        }
+        uint32 n = PGSIZE - done;
+        if (n > MMAP_WB_CHUNK) {
+            n = MMAP_WB_CHUNK;
+        }
+        if (off + done + n > ip->size) {
+            n = ip->size - (off + done);
+        }
+        int r = writei(ip, 0, pa + done, off + done, n);
+        iunlock(ip);
+        end_op();
+        if (r != (int)n) {
+            break;
+        }
+        done += n;
+    }
+    *pte &= ~PTE_D;
+    return 0;
+}
+
+// vma_sync: 写回 [start, end) 中的脏页 (只对 MAP_SHARED 的文件映射有意义)
+static void vma_sync(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+    if (!(v->flags & MAP_SHARED) || v->file == NULL || p->pagetable == NULL) {
+        return;
+    }
+    vm_range_walk(p->pagetable, start, end, 0, writeback_leaf, v);
+}
+
+// 找一段空闲区间建立 VMA, 文件/共享内存段由调用者填写
+static struct vma* vma_create(struct proc *p, uint64 len, int prot, int flags)
+{
+    len = PG_ROUND_UP(len);
+    uint64 start = vma_find_gap(p, len);
+    if (start == 0) {
+        return NULL;
+    }
+    struct vma *v = vma_alloc();
+    if (v == NULL) {
+        return NULL;
+    }
+    v->start = start;
+    v->end = start + len;
+    v->prot = prot;
+    v->flags = flags;
+    vma_insert(p, v);
+    return v;
+}
+
+// 预先填充整个 VMA, 有页面分配失败 (内存不足) 时停下并返回 -1
+static int vma_populate(struct proc *p, struct vma *v)
+{
+    if (v->prot == PROT_NONE) {
+        return 0;
+    }
+    int ftype = (v->file == NULL && (v->prot & PROT_WRITE)) ? VM_FAULT_WRITE :
+                (v->prot & PROT_READ) ? VM_FAULT_READ : VM_FAULT_EXEC;
+    for (uint64 a = v->start; a < v->end; a += PGSIZE) {
+        if (mmap_fault(p, v, a, ftype) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint64 mmap_map(struct proc *p, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+    int type = flags & (MAP_SHARED | MAP_PRIVATE);
+    if (len == 0 || (type != MAP_SHARED && type != MAP_PRIVATE) || (off % PGSIZE) != 0) {
+        return (uint64)-1;
+    }
+    if (flags & MAP_ANONYMOUS) {
+        f = NULL;
+        off = 0;
+    } else {
+        if (f == NULL || f->type != FD_INODE || !f->readable) {
+            return (uint64)-1;
+        }
+        // 共享的可写映射最终要写回文件
+        if (type == MAP_SHARED && (prot & PROT_WRITE) && !f->writable) {
+            return (uint64)-1;
+        }
+    }
+
+    struct vma *v = vma_create(p, len, prot, flags);
+    if (v == NULL) {
+        return (uint64)-1;
+    }
+    v->file = f ? filedup(f) : NULL;
+    v->off = off;
+
+    // 共享的匿名映射没有后备文件, fork 之后只能靠共享同一批物理页来保持一致,
+    // 因此总是在建立映射时填充; 缺了任何一页, 之后父子进程会各自分配而不再共享, 整个 mmap 失败
+    if (f == NULL && type == MAP_SHARED) {
+        if (vma_populate(p, v) < 0) {
+            mmap_unmap(p, v->start, v->end - v->start);
+            return (uint64)-1;
+        }
+    } else if (flags & MAP_POPULATE) {
+        // 和 Linux 一样, 预填充失败不影响 mmap 本身, 剩下的页在访问时再分配
+        vma_populate(p, v);
+    }
+    return v->start;
+}
+
+// mmap_map_shm: 把共享内存段的前 len 字节映射进进程 (shmat), 调用者已为这次映射取得段的引用
+uint64 mmap_map_shm(struct proc *p, struct shmseg *seg, uint64 len, int prot)
+{
+    struct vma *v = vma_create(p, len, prot, MAP_SHARED);
+    if (v == NULL) {
+        return (uint64)-1;
+    }
+    v->shm = seg;
+    vma_populate(p, v);
+    return v->start;
+}
+
+int mmap_unmap(struct proc *p, uint64 addr, uint64 len)
+{
+    if ((addr % PGSIZE) != 0 || len == 0) {
+        return -1;
+    }
+    uint64 end = addr + PG_ROUND_UP(len);
+    if (end < addr || end > MMAP_TOP) {
+        return -1;
+    }
+
+    struct vma **pp = &p->vmas;
+    while (*pp) {
+        struct vma *v = *pp;
+        if (v->start >= end) {
+            break;
+        }
+        if (v->end <= addr) {
+            pp = &v->next;
+            continue;
+        }
+        uint64 s = addr > v->start ? addr : v->start;
+        uint64 e = end < v->end ? end : v->end;
+        // 从中间挖掉一段要多一个 VMA: 在动任何页面之前分配, 失败时什么都没有改变
+        // (这种情况下区间完全落在 v 中, 前面没有处理过别的 VMA)
+        struct vma *tail = NULL;
+        if (s != v->start && e != v->end && (tail = vma_alloc()) == NULL) {
+            return -1;
+        }
+        vma_sync(p, v, s, e);
+        // 变空的页表页会被回收, 持有 p->lock 以免 memstat 同时遍历到它们
+        spinlock_acquire(&p->lock);
+        int r = vm_unmappages(p->pagetable, s, e - s, true);
+        spinlock_release(&p->lock);
+        if (r < 0) {
+            if (tail) {
+                vma_free(tail);
+            }
+            return -1;
+        }
+
+        if (s == v->start && e == v->end) {
+            *pp = v->next;
+            vma_free(v);
+            continue;
+        }
+        if (s == v->start) {
+            v->off += e - v->start;
+            v->start = e;
+        } else if (e == v->end) {
+            v->end = s;
+        } else {
+            // 从中间挖掉一段: 拆成前后两个 VMA
+            *tail = *v;
+            tail->start = e;
+            tail->off = v->off + (e - v->start);
+            tail->file = v->file ? filedup(v->file) : NULL;
+            if (tail->shm) {
+                shm_dup(tail->shm);
+            }
+            v->end = s;
+            v->next = tail;
+        }
+        pp = &v->next;
+    }
+    return 0;
+}
+
+// mmap_fault: 处理落在 VMA 中的缺页, va 已按页对齐
+// - 页面不存在: 分配一页, 文件映射从 inode 读入内容; 私有匿名映射的读访问只映射共享零页
+// - 对共享映射中只读的干净页面写入: 打开写权限并标记为脏
+int mmap_fault(struct proc *p, struct vma *v, uint64 va, int type)
+{
+    if ((type == VM_FAULT_WRITE && !(v->prot & PROT_WRITE)) ||
+        (type == VM_FAULT_READ && !(v->prot & PROT_READ)) ||
+        (type == VM_FAULT_EXEC && !(v->prot & PROT_EXEC))) {
+        return -1;
+    }
+    bool shared = (v->flags & MAP_SHARED) != 0;
+
+    pte_t *pte = vm_getpte(p->pagetable, va, false);
+    if (pte && (*pte & PTE_V)) {
+        if (type != VM_FAULT_WRITE) {
+            return 0;
+        }
+        if (!shared) {
+            return (*pte & PTE_W) ? 0 : -1;
+        }
+        *pte |= PTE_W | PTE_D;
+        uvm_tlb_flush(p);
+        p->min_flt++;
+        return 0;
+    }
+
+    if (type == VM_FAULT_READ && !shared && v->file == NULL && v->shm == NULL) {
+        // 私有匿名映射的第一次读取: 映射共享零页, 可写的区域在第一次写入时再分配私有页
+        int perm = PTE_U | PTE_R | PTE_A;
+        if (v->prot & PROT_EXEC)  perm |= PTE_X;
+        if (v->prot & PROT_WRITE) perm |= PTE_COW;
+        if (uvm_map_zero(p->pagetable, va, perm) < 0) {
+            return -1;
+        }
+        p->min_flt++;
+        return 0;
+    }
+
+    uint64 pa;
+    if (v->shm) {
+        // 共享内存段的页面在 shmget 时已经分配, 这里只增加引用
+        pa = shm_page(v->shm, (v->off + (va - v->start)) / PGSIZE);
+        pmem_ref_inc(pa);
+    } else {
+        void *mem = uvm_alloc_page(true);
+        if (mem == NULL) {
+            return -1;
+        }
+        if (v->file) {
+            struct inode *ip = v->file->ip;
+            ilock(ip);
+            readi(ip, 0, (uint64)mem, (uint32)(v->off + (va - v->start)), PGSIZE);
+            iunlock(ip);
+        }
+        pa = (uint64)mem;
+    }
+
+    int perm = PTE_U | PTE_A;
+    if (v->prot & PROT_READ)  perm |= PTE_R;
+    if (v->prot & PROT_EXEC)  perm |= PTE_X;
+    if (v->prot & PROT_WRITE) {
+        // 共享的文件映射只在真正写入时才给写权限, 这样 PTE_D 能准确反映哪些页需要写回
+        if (!shared || v->file == NULL || type == VM_FAULT_WRITE) {
+            perm |= PTE_W | PTE_D;
+        }
+    }
+
+    pte = vm_getpte(p->pagetable, va, true);
+    if (pte == NULL) {
+        pmem_free(pa, false);
+        return -1;
+    }
+    vm_pte_set(pte, PA_TO_PTE(pa) | perm | PTE_V);
+    if (v->file) {
+        p->maj_flt++;
+    } else {
+        p->min_flt++;
+    }
+    return 0;
+}
+
+// mmap_fork: 把父进程的 VMA 和已经填充的页面复制给子进程
+// 共享映射与父进程共用物理页, 私有映射按写时复制处理
+int mmap_fork(struct proc *p, struct proc *np)
+{
+    for (struct vma *v = p->vmas; v; v = v->next) {
+        struct vma *nv = vma_alloc();
+        if (nv == NULL) {
+            return -1;
+        }
+        *nv = *v;
+        nv->next = NULL;
+        nv->file = v->file ? filedup(v->file) : NULL;
+        if (nv->shm) {
+            shm_dup(nv->shm);
+        }
+        vma_insert(np, nv);
+        if (uvmcopy_range(p->pagetable, np->pagetable, v->start, v->end,
+                          (v->flags & MAP_SHARED) != 0) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// mmap_release: 解除进程的所有映射 (exit/exec), writeback 为真时先写回共享文件映射的脏页
+// 变空的页表页会被回收, 解除映射时要持有 p->lock 以免 memstat 同时遍历到它们:
+// exit/exec 要写回脏页, 调用时没有持锁; fork 失败和 free_process 的调用者已经持有
+void mmap_release(struct proc *p, bool writeback)
+{
+    bool locked = spinlock_holding(&p->lock);
+    while (p->vmas) {
+        struct vma *v = p->vmas;
+        p->vmas = v->next;
+        if (p->pagetable) {
+            if (writeback) {
+                vma_sync(p, v, v->start, v->end);
+            }
+            if (!locked) {
+                spinlock_acquire(&p->lock);
+            }
+            vm_unmappages(p->pagetable, v->start, v->end - v->start, true);
+            if (!locked) {
+                spinlock_release(&p->lock);
+            }
+        }
+        vma_free(v);
+    }
+}
+
+// mmap_madvise: [addr, addr+len) 必须完全落在堆 [heap_base, sz) 或已有的 VMA 中;
+// 程序映像和用户栈 (heap_base 之下) 中的页面丢弃后无法恢复 (.data 会变成零页), 不接受
+// - MADV_DONTNEED: 释放页面; 私有映射再次访问时重新读文件或得到零页, 共享文件映射先写回脏页。
+//   共享匿名映射和共享内存段丢弃后无法找回内容, 不支持
+// - MADV_WILLNEED: 预先处理缺页 (包括换入), 堆和可写的私有匿名映射直接分配私有页;
+//   内存不足时提前停止, 不算错误
+int mmap_madvise(struct proc *p, uint64 addr, uint64 len, int advice)
+{
+    if ((addr % PGSIZE) != 0 || len == 0) {
+        return -1;
+    }
+    if (advice != MADV_NORMAL && advice != MADV_WILLNEED && advice != MADV_DONTNEED) {
+        return -1;
+    }
+    uint64 end = addr + PG_ROUND_UP(len);
+    if (end < addr) {
+        return -1;
+    }
+    uint64 heap_end = PG_ROUND_UP(p->sz);
+    if (addr < p->heap_base) {
+        return -1;
+    }
+
+    // 先检查整个区间, 不做到一半才失败
+    for (uint64 a = addr; a < end;) {
+        if (a < heap_end) {
+            a = heap_end;
+            continue;
+        }
+        struct vma *v = mmap_find(p, a);
+        if (v == NULL) {
+            return -1;
+        }
+        if (advice == MADV_DONTNEED && (v->flags & MAP_SHARED) && v->file == NULL) {
+            return -1;
+        }
+        a = v->end;
+    }
+    if (advice == MADV_NORMAL) {
+        return 0;
+    }
+
+    for (uint64 a = addr; a < end;) {
+        struct vma *v = NULL;
+        uint64 e = heap_end;
+        if (a >= heap_end) {
+            v = mmap_find(p, a);
+            e = v->end;
+        }
+        if (e > end) {
+            e = end;
+        }
+        if (advice == MADV_DONTNEED) {
+            if (v) {
+                vma_sync(p, v, a, e);
+            }
+            spinlock_acquire(&p->lock);
+            int r = uvm_discard(p->pagetable, a, e);
+            spinlock_release(&p->lock);
+            if (r < 0) {
+                // 只有堆中的大页需要拆开, 而堆是第一段, 失败时还没有丢弃任何页面
+                return -1;
+            }
+        } else if (v == NULL || (v->prot & PROT_READ)) {
+            // 堆和可写的私有匿名映射读缺页只会映射共享零页, 要真正分配私有页必须按写入预取;
+            // 已经映射零页的页面同样换成私有页
+            bool anon = v == NULL ||
+                        (!(v->flags & MAP_SHARED) && v->file == NULL && v->shm == NULL && (v->prot & PROT_WRITE));
+            int type = anon ? VM_FAULT_WRITE : VM_FAULT_READ;
+            for (uint64 va = a; va < e; va += PGSIZE) {
+                pte_t *pte = vm_getpte(p->pagetable, va, false);
+                if (pte && (*pte & PTE_V) && !(anon && PTE_TO_PA(*pte) == uvm_zero_page())) {
+                    continue;
+                }
+                if (vm_fault(p, va, type) < 0) {
+                    return 0;
+                }
+            }
+        }
+        a = e;
+    }
+    return 0;
+}
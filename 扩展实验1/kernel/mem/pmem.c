@@ -4,175 +4,841 @@
 #include "riscv.h"
 #include "memlayout.h"
 #include "lib/string.h"
+#include "proc/proc.h"
+#include "dev/fdt.h"
 
-#define KERNEL_PAGES 1024   // 将原来的内核物理页数由16MB(4096页)改为4MB(1024页)
-#define MAX_KERNEL_PAGES  KERNEL_PAGES
-#define MAX_USER_PAGES   ((128 * 1024 * 1024 / PGSIZE) - KERNEL_PAGES)
+// 所有可分配的物理页构成一个统一的 zone, 不再静态划分内核区/用户区
+// 内核页(页表、内核栈、trapframe、slab...)和用户页从同一个伙伴系统分配,
+// 只按用途分别统计, 并用水位线为内核保留一部分页面
+// zone 的大小取决于设备树给出的内存大小, 元数据数组在 pmem_init 中紧跟内核映像分配
 
-static uint8 kern_state[MAX_KERNEL_PAGES];
-static uint8 user_state[MAX_USER_PAGES];
+// 每个物理页一项元数据
+//   flags 页面状态, 见下面的 PG_* 位
+//   ref   已分配页面的引用计数 (COW 共享时大于 1), 原子更新
+//   age   用户页连续多少个工作集采样周期没有被访问 (见 mem/wss.h)
+//   nptes 页表页中非零 PTE 的数量, 由 vmem 维护, 降到 0 时这张页表可以回收;
+//         多页 slab 中则是这一页到 slab 首页的页数, 由 kmalloc 维护
+typedef struct page_meta {
+    uint8 flags;
+    uint8 age;
+    uint16 nptes;
+    uint32 ref;
+} page_meta_t;
 
-typedef struct page_node { 
+// flags 中的各位:
+//   PG_FREE  页面空闲(位于伙伴链表、某个CPU缓存或预清零池中), 为 0 表示已分配
+//   PG_BUDDY 页面是一个空闲伙伴块的首页, 低4位记录块的阶
+//   PG_KERN  已分配的页面属于内核 (没有该位则属于用户)
+#define PG_FREE       0x80
+#define PG_BUDDY      0x40
+#define PG_KERN       0x20
+#define PG_ORDER_MASK 0x0f
+
+// 空闲块首页中存放的双向链表节点
+typedef struct page_node {
     struct page_node* next;
+    struct page_node* prev;
  } page_node_t;
 
+// 每个CPU的页面缓存(magazine)
+// 单页分配/释放只访问本CPU的缓存(关中断即可, 无需加锁),
+// 缓存空了一次从全局链表批量取 PCP_BATCH 页, 满了一次批量归还 PCP_BATCH 页,
+// 这样全局自旋锁大约每 PCP_BATCH 次操作才被访问一次
+#define PCP_BATCH 16
+#define PCP_HIGH  (PCP_BATCH * 2)
+
+// 预清零页池: 空闲的 hart 在后台把空闲页清零后放入池中,
+// pmem_alloc_zeroed 直接取用, 调用者不必再 memset
+#define ZPOOL_MAX     128
+
+typedef struct pcp_cache {
+    uint32 count;            // 缓存中的页数
+    uint64 pages[PCP_HIGH];  // 缓存的空闲页(栈, 后进先出)
+    uint64 hits;             // 直接从本地缓存满足的分配次数
+    uint64 refills;          // 从全局链表批量补充的次数
+    uint64 drains;           // 向全局链表批量归还的次数
+} pcp_cache_t;
+
+// 每种用途的水位线 (单位: 页, 与 zone 中的空闲页数比较)
+//   min  分配后空闲页不得低于 min, 否则该用途的分配失败
+//   low  分配后空闲页低于 low 时触发回收: 把各CPU缓存和预清零池中的页面还给伙伴系统
+//   high 空闲页高于 high 时才允许后台预清零等“囤积”行为
+typedef struct watermark {
+    uint32 min;
+    uint32 low;
+    uint32 high;
+} watermark_t;
 
-// 许多物理页构成一个可分配的区域 
-typedef struct alloc_region { 
+// 许多物理页构成一个可分配的 zone, 内部用伙伴系统管理
+// 阶为 k 的块包含 2^k 个物理页, 块的起始页号(相对 base)是 2^k 的整数倍
+typedef struct zone {
     uint64 begin; // 起始物理地址
     uint64 end; // 终止物理地址
-    spinlock_t lk; // 自旋锁(保护下面两个变量)
-    uint32 allocable; // 可分配页面数
-    page_node_t list_head; // 可分配链的链头节点 
+    uint64 base;  // begin 向下对齐到最大块大小, 页号从这里开始计算
+    spinlock_t lk; // 自旋锁(保护下面的空闲链表和计数)
+    uint32 allocable; // 伙伴链表中的空闲页面数
+    page_node_t free_area[PMEM_MAX_ORDER + 1]; // 每个阶一条循环双向链表(哨兵节点)
+    uint32 nr_free[PMEM_MAX_ORDER + 1];        // 每个阶的空闲块数
 
-    // 新增：总页数 + 每页状态
     uint32 total_pages;
-    uint8* state;    // 指向一个长度为 total_pages 的数组
-} alloc_region_t; 
-// 内核和用户可分配的物理页分开
+    page_meta_t* meta;    // 指向一个长度为 total_pages 的数组
+
+    pcp_cache_t pcp[NCPU]; // 每个CPU的页面缓存, 只由对应CPU在关中断时访问
+    volatile uint32 drain_req; // 每个CPU一位: 请求该CPU在下次进入 pmem 时清空自己的缓存
+
+    spinlock_t zlk;           // 保护预清零页池和它的计数
+    uint32 zcount;            // 池中的页数
+    uint64 zpool[ZPOOL_MAX];  // 已清零的空闲页(flags 仍为 PG_FREE)
+    uint64 zhits;             // pmem_alloc_zeroed 命中池的次数
+    uint64 zmisses;           // 池为空, 只能现场清零的次数
+    uint64 zfilled;           // 后台清零入池的页数
+
+    watermark_t wmark[2];     // 按用途的水位线, 下标为 in_kernel
+    uint32 used[2];           // 按用途统计的已分配页数 (原子更新)
+    uint64 rebalances;        // 触发回收的次数
+    uint64 wmark_fails;       // 因低于 min 水位线而拒绝的分配次数
+} zone_t;
+
+static zone_t zone;
+
+static inline uint32 page_index(uint64 page) {
+    return (page - zone.base) / PGSIZE;
+}
+
+static inline uint64 index_page(uint32 idx) {
+    return zone.base + (uint64)idx * PGSIZE;
+}
+
+static inline void list_add(page_node_t* head, page_node_t* node)
+{
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+}
+
+static inline void list_del(page_node_t* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+}
 
- static alloc_region_t kern_region, user_region;
+// buddy_remove: 把首页号为 idx、阶为 order 的空闲块从链表中摘下 (调用者持锁)
+static void buddy_remove(uint32 idx, int order)
+{
+    list_del((page_node_t*)index_page(idx));
+    zone.meta[idx].flags &= ~(PG_BUDDY | PG_ORDER_MASK);
+    zone.nr_free[order]--;
+}
 
- static inline uint32 page_index(alloc_region_t* region, uint64 page) {
-    return (page - region->begin) / PGSIZE;
+static void buddy_insert(uint32 idx, int order)
+{
+    list_add(&zone.free_area[order], (page_node_t*)index_page(idx));
+    zone.meta[idx].flags = PG_FREE | PG_BUDDY | order;
+    zone.nr_free[order]++;
+}
+
+// buddy_alloc: 取出一个阶为 order 的块, 必要时拆分更大的块 (调用者持锁)
+// 返回块首页的物理地址, 失败返回 0; 块内各页的 flags 仍为 PG_FREE
+static uint64 buddy_alloc(int order)
+{
+    int o = order;
+    while (o <= PMEM_MAX_ORDER && zone.nr_free[o] == 0) {
+        o++;
+    }
+    if (o > PMEM_MAX_ORDER) {
+        return 0;
+    }
+
+    uint64 page = (uint64)zone.free_area[o].next;
+    uint32 idx = page_index(page);
+    buddy_remove(idx, o);
+
+    // 把多余的后半部分逐级挂回较低阶的链表
+    while (o > order) {
+        o--;
+        buddy_insert(idx + (1u << o), o);
+    }
+    zone.allocable -= (1u << order);
+    return page;
+}
+
+// buddy_free: 归还一个阶为 order 的块, 并与空闲的伙伴逐级合并 (调用者持锁)
+// 块内各页的 flags 必须已经标记为 PG_FREE
+static void buddy_free(uint64 page, int order)
+{
+    uint32 idx = page_index(page);
+    zone.allocable += (1u << order);
+
+    while (order < PMEM_MAX_ORDER) {
+        uint32 buddy = idx ^ (1u << order);
+        if (buddy >= zone.total_pages) {
+            break;
+        }
+        // 伙伴必须是同阶的空闲块首页才能合并 (CPU缓存中的页没有 PG_BUDDY)
+        if (zone.meta[buddy].flags != (PG_FREE | PG_BUDDY | order)) {
+            break;
+        }
+        buddy_remove(buddy, order);
+        if (buddy < idx) {
+            idx = buddy;
+        }
+        order++;
+    }
+    buddy_insert(idx, order);
+}
+
+// zone_free_approx: 不持锁估算 zone 中的空闲页数 (伙伴链表 + 各CPU缓存 + 预清零池)
+// 只用于水位线判断, 读到略旧的值没有关系
+static uint32 zone_free_approx(void)
+{
+    uint32 n = zone.allocable + zone.zcount;
+    for (int i = 0; i < NCPU; i++) {
+        n += zone.pcp[i].count;
+    }
+    return n;
 }
 
  // pmem_init: 初始化物理内存管理器
 void pmem_init(void) {
     // ALLOC_BEGIN 来自链接脚本 kernel.ld 中的 'end' 符号
     // 它标志着内核代码和静态数据区的结束位置
-    uint64 alloc_begin = PG_ROUND_UP((uint64)ALLOC_BEGIN);
-    uint64 alloc_end = KERNEL_BASE + 128 * 1024 * 1024; // 128MB 物理内存
-
-    // 初始化内核物理页区域
-    kern_region.begin = alloc_begin;
-    kern_region.end = kern_region.begin + KERNEL_PAGES * PGSIZE;
-    kern_region.allocable = 0;
-    kern_region.list_head.next = NULL;
-    spinlock_init(&kern_region.lk, "kernel_pmem_lock");
-    kern_region.total_pages = KERNEL_PAGES;
-    kern_region.state       = kern_state;
-    memset(kern_region.state, 0, sizeof(kern_state)); // 初始都“未使用”
-
-    // 初始化用户物理页区域
-    user_region.begin = kern_region.end;
-    user_region.end = alloc_end;
-    user_region.allocable = 0;
-    user_region.list_head.next = NULL;
-    spinlock_init(&user_region.lk, "user_pmem_lock");
-    user_region.total_pages = (user_region.end - user_region.begin) / PGSIZE;
-    user_region.state       = user_state;
-    memset(user_region.state, 0, sizeof(user_state));
-
-    // 逆序初始化，让低地址页面先被分配
-    for (uint64 p = kern_region.end - PGSIZE; p >= kern_region.begin; p -= PGSIZE) {
-        pmem_free(p, true);
-    }
-    for (uint64 p = user_region.end - PGSIZE; p >= user_region.begin; p -= PGSIZE) {
-        pmem_free(p, false);
+    uint64 begin = PG_ROUND_UP((uint64)ALLOC_BEGIN);
+    uint64 end = fdt_mem_end();
+    uint64 base = begin & ~((PGSIZE << PMEM_MAX_ORDER) - 1);
+
+    // meta[] 从向下对齐到最大块的 base 开始编号, 每个物理页一项 (1GiB 内存约 2MiB)
+    // 数组直接放在内核映像之后, 和映像一样不归 zone 管理
+    zone.total_pages = (end - base) / PGSIZE;
+    zone.meta = (page_meta_t*)begin;
+    begin = PG_ROUND_UP(begin + (uint64)zone.total_pages * sizeof(page_meta_t));
+    if (begin >= end) {
+        panic("pmem_init: no memory left after page metadata");
     }
+
+    zone.begin = begin;
+    zone.end = end;
+    zone.base = base;
+    zone.allocable = 0;
+    spinlock_init(&zone.lk, "pmem_zone_lock");
+    for (int o = 0; o <= PMEM_MAX_ORDER; o++) {
+        zone.free_area[o].next = zone.free_area[o].prev = &zone.free_area[o];
+        zone.nr_free[o] = 0;
+    }
+    // [base, begin) 之间的页面不归 zone 管理, 永远保持“已分配”, 不会被合并
+    memset(zone.meta, 0, zone.total_pages * sizeof(page_meta_t));
+    memset(zone.pcp, 0, sizeof(zone.pcp));
+    zone.drain_req = 0;
+    spinlock_init(&zone.zlk, "pmem_zero_pool");
+    zone.zcount = 0;
+    zone.zhits = zone.zmisses = zone.zfilled = 0;
+    zone.used[0] = zone.used[1] = 0;
+    zone.rebalances = zone.wmark_fails = 0;
+
+    for (uint64 p = begin; p < end; p += PGSIZE) {
+        zone.meta[page_index(p)].flags = PG_FREE;
+    }
+    // 每次挂入满足对齐要求且不越界的最大块
+    uint64 p = begin;
+    while (p < end) {
+        uint32 idx = page_index(p);
+        int order = PMEM_MAX_ORDER;
+        while (order > 0 && ((idx & ((1u << order) - 1)) != 0 ||
+                             p + ((uint64)PGSIZE << order) > end)) {
+            order--;
+        }
+        buddy_free(p, order);
+        p += (uint64)PGSIZE << order;
+    }
+
+    // 水位线按 zone 大小计算 (128MB 时约为: 用户 min=2MB, 内核 low=1MB)
+    // 用户分配不能吃掉最后 min 个页面, 它们留给页表、内核栈等内核分配
+    uint32 pages = zone.allocable;
+    zone.wmark[0].min = pages / 64;
+    zone.wmark[0].low = zone.wmark[0].min * 2;
+    zone.wmark[0].high = zone.wmark[0].min * 3;
+    zone.wmark[1].min = 0;
+    zone.wmark[1].low = pages / 128;
+    zone.wmark[1].high = zone.wmark[1].low * 2;
 }
 
-// pmem_free: 释放一个物理页面
-void pmem_free(uint64 page, bool in_kernel) {
-    alloc_region_t* region = in_kernel ? &kern_region : &user_region;
+// region_take: 持锁一次, 从伙伴系统取出至多 n 个单页
+// 不修改 meta[] (页面仍视为空闲, 由调用者决定是否标记为已分配)
+static int region_take(int n, uint64 pages[])
+{
+    int taken = 0;
 
+    spinlock_acquire(&zone.lk);
+    while (taken < n) {
+        uint64 page = buddy_alloc(0);
+        if (page == 0) {
+            break;
+        }
+        pages[taken++] = page;
+    }
+    spinlock_release(&zone.lk);
+    return taken;
+}
+
+// region_put: 持锁一次, 把 n 个已标记为空闲的单页归还伙伴系统
+static void region_put(int n, uint64 pages[])
+{
+    spinlock_acquire(&zone.lk);
+    for (int i = 0; i < n; i++) {
+        buddy_free(pages[i], 0);
+    }
+    spinlock_release(&zone.lk);
+}
+
+// pcp_drain_all: 把一个CPU缓存中的所有页面还给伙伴系统 (调用者已关中断)
+static void pcp_drain_all(pcp_cache_t* pc)
+{
+    if (pc->count > 0) {
+        region_put(pc->count, pc->pages);
+        pc->count = 0;
+        pc->drains++;
+    }
+}
+
+// pcp_get: 关中断后取得本CPU的缓存; 如果有回收请求, 先清空本地缓存
+static pcp_cache_t* pcp_get(void)
+{
+    int cpu = mycpuid();
+    pcp_cache_t* pc = &zone.pcp[cpu];
+    if (zone.drain_req & (1u << cpu)) {
+        __sync_fetch_and_and(&zone.drain_req, ~(1u << cpu));
+        pcp_drain_all(pc);
+    }
+    return pc;
+}
+
+// zone_rebalance: 空闲页低于 low 水位线时调用
+// 预清零池立刻还给伙伴系统, 各CPU缓存则请求其所属CPU在下次进入 pmem 时自行清空
+// 这样缓存中零散的页面可以重新合并, 满足其他用途和高阶分配
+static void zone_rebalance(void)
+{
+    uint64 pages[PCP_BATCH];
+    bool did = false;
+
+    for (;;) {
+        int n = 0;
+        spinlock_acquire(&zone.zlk);
+        while (n < PCP_BATCH && zone.zcount > 0) {
+            pages[n++] = zone.zpool[--zone.zcount];
+        }
+        spinlock_release(&zone.zlk);
+        if (n == 0) {
+            break;
+        }
+        region_put(n, pages);
+        did = true;
+    }
+
+    for (int i = 0; i < NCPU; i++) {
+        if (zone.pcp[i].count > 0 && !(zone.drain_req & (1u << i))) {
+            __sync_fetch_and_or(&zone.drain_req, 1u << i);
+            did = true;
+        }
+    }
+    if (did) {
+        zone.rebalances++;
+    }
+}
+
+// watermark_ok: 为 in_kernel 用途再分配 n 页后, 空闲页是否仍不低于它的 min 水位线
+static bool watermark_ok(bool in_kernel, uint32 n)
+{
+    uint32 min = zone.wmark[in_kernel].min;
+    if (min == 0) {
+        return true;
+    }
+    if (zone_free_approx() >= min + n) {
+        return true;
+    }
+    zone.wmark_fails++;
+    return false;
+}
+
+// watermark_check: 分配成功后检查 low 水位线, 必要时触发回收
+static void watermark_check(bool in_kernel)
+{
+    if (zone.allocable < zone.wmark[in_kernel].low) {
+        zone_rebalance();
+    }
+}
+
+// 检查页面地址并释放一个引用 (检测重复释放和用途不符)
+// 引用计数降到 0 时标记为空闲并返回 true, 否则页面仍被别人共享, 返回 false
+// flags 只由当前拥有该页的一方修改, 因此这里不需要持有区域锁
+static bool mark_free(uint64 page, bool in_kernel)
+{
     if ((page % PGSIZE) != 0) {
         panic("pmem_free: page address not aligned");
     }
-    if (page < region->begin || page >= region->end) {
-        panic("pmem_free: page address out of  region ");
+    if (page < zone.begin || page >= zone.end) {
+        panic("pmem_free: page address out of zone");
     }
-    uint32 idx = page_index(region, page);
-
-    spinlock_acquire(&region->lk);
+    uint32 idx = page_index(page);
     //duplicate free check
-    if (region->state[idx] == 1) {
-        spinlock_release(&region->lk);
+    if (zone.meta[idx].flags & PG_FREE) {
         panic("pmem_free: double free detected (page already free)");
     }
-    region->state[idx] = 1;  // 标记为空闲
+    if (((zone.meta[idx].flags & PG_KERN) != 0) != in_kernel) {
+        panic("pmem_free: page freed with the wrong owner");
+    }
+    if (__sync_sub_and_fetch(&zone.meta[idx].ref, 1) != 0) {
+        return false;
+    }
+    zone.meta[idx].flags = PG_FREE;  // 标记为空闲
+    __sync_fetch_and_sub(&zone.used[in_kernel], 1);
 
+#ifdef PMEM_POISON
     memset((void*)page, 1, PGSIZE);
-    // 将页面地址转换为 page_node_t 指针
-    page_node_t* node = (page_node_t*)page;
-    // 头插法将页面插入空闲链表
-    node->next = region->list_head.next;
-    region->list_head.next = node;
-    region->allocable++;
-    spinlock_release(&region->lk);
+#endif
+    return true;
+}
+
+// claim_page: 把一个空闲页标记为已分配, 不改动页面内容
+static void claim_page(uint64 page, bool in_kernel)
+{
+    uint32 idx = page_index(page);
+    if (!(zone.meta[idx].flags & PG_FREE)) {
+        // 空闲链表或CPU缓存里出现了已分配的页面, 说明元数据被破坏
+        panic("pmem_alloc: free list corrupted (page already allocated)");
+    }
+    zone.meta[idx].flags = in_kernel ? PG_KERN : 0;  // 标记为“已分配”并记录用途
+    zone.meta[idx].ref = 1;
+    zone.meta[idx].age = 0;
+    zone.meta[idx].nptes = 0;
+    __sync_fetch_and_add(&zone.used[in_kernel], 1);
+}
+
+static void mark_allocated(uint64 page, bool in_kernel)
+{
+    claim_page(page, in_kernel);
+
+#ifdef PMEM_POISON
+    // 填充调试模式 (make PMEM_POISON=1 时开启)
+    memset((void*)page, 5, PGSIZE);
+#endif
+}
+
+// zpool_pop: 从预清零页池取出一页, 池为空返回 0
+// want_zero 为 true 时记入命中/未命中统计
+static uint64 zpool_pop(bool want_zero)
+{
+    uint64 page = 0;
+
+    spinlock_acquire(&zone.zlk);
+    if (zone.zcount > 0) {
+        page = zone.zpool[--zone.zcount];
+        if (want_zero) {
+            zone.zhits++;
+        }
+    } else if (want_zero) {
+        zone.zmisses++;
+    }
+    spinlock_release(&zone.zlk);
+    return page;
 }
 
-// pmem_alloc: 分配一个物理页面
+// pmem_free: 释放一个物理页面
+// 页面被共享时只减少引用计数, 最后一个引用释放时才真正归还
+void pmem_free(uint64 page, bool in_kernel) {
+    if (!mark_free(page, in_kernel)) {
+        return;
+    }
+
+    push_off();
+    pcp_cache_t* pc = pcp_get();
+    if (pc->count == PCP_HIGH) {
+        // 本地缓存已满: 把最早进入的 PCP_BATCH 页批量还给全局链表
+        region_put(PCP_BATCH, pc->pages);
+        memmove(pc->pages, pc->pages + PCP_BATCH, (PCP_HIGH - PCP_BATCH) * sizeof(uint64));
+        pc->count -= PCP_BATCH;
+        pc->drains++;
+    }
+    pc->pages[pc->count++] = page;
+    pop_off();
+}
+
+// pmem_alloc: 分配一个物理页面, in_kernel 表示页面的用途
 void* pmem_alloc(bool in_kernel) {
-    alloc_region_t* region = in_kernel ? &kern_region : &user_region;
-    page_node_t* node = NULL;
-
-    spinlock_acquire(&region->lk);
-    if (region->list_head.next) {
-        // 从链表头取出一个节点
-        node = region->list_head.next;
-        region->list_head.next = node->next;
-        region->allocable--;
-
-        uint64 page = (uint64)node;
-        uint32 idx = page_index(region, page);
-        if (region->state[idx] == 0) {
-            // 理论上这里应该永远是 1（空闲），如果是 0 就说明 freelist 被破坏
-            // 你可以 panic 或者至少打印 warning
+    uint64 page = 0;
+
+    if (!watermark_ok(in_kernel, 1)) {
+        return NULL;
+    }
+
+    push_off();
+    pcp_cache_t* pc = pcp_get();
+    if (pc->count > 0) {
+        pc->hits++;
+    } else {
+        // 本地缓存为空: 从全局链表批量补充
+        pc->count = region_take(PCP_BATCH, pc->pages);
+        if (pc->count > 0) {
+            pc->refills++;
         }
-        region->state[idx] = 0;  // 标记为“已分配”
     }
-    spinlock_release(&region->lk);
+    if (pc->count > 0) {
+        page = pc->pages[--pc->count];
+    }
+    pop_off();
 
-    if (node) {
-        memset((void*)node, 5, PGSIZE);
+    if (page == 0) {
+        // 伙伴系统已空, 池中清零过的页同样可用
+        page = zpool_pop(false);
+    }
+    if (page) {
+        mark_allocated(page, in_kernel);
+        watermark_check(in_kernel);
     }
 
     // 如果成功分配，返回页面地址；否则返回 NULL
-    return (void*)node;
+    return (void*)page;
+}
+
+// pmem_alloc_zeroed: 分配一个内容全为 0 的物理页面
+// 优先从预清零页池取, 池为空时退回 pmem_alloc 并现场清零
+void* pmem_alloc_zeroed(bool in_kernel) {
+    if (!watermark_ok(in_kernel, 1)) {
+        return NULL;
+    }
+
+    uint64 page = zpool_pop(true);
+    if (page) {
+        claim_page(page, in_kernel);
+        return (void*)page;
+    }
+
+    void* mem = pmem_alloc(in_kernel);
+    if (mem) {
+        memset(mem, 0, PGSIZE);
+    }
+    return mem;
+}
+
+// zpool_refill: 为预清零页池补充一页, 返回补充的页数(0 或 1)
+static int zpool_refill(void)
+{
+    // 不持锁读取只用于提前判断, 真正入池时会再检查一次
+    // 空闲页不高于 high 水位线时不再囤积, 把页面留给普通分配
+    if (zone.zcount >= ZPOOL_MAX || zone.allocable <= zone.wmark[0].high) {
+        return 0;
+    }
+    uint64 page;
+    if (region_take(1, &page) == 0) {
+        return 0;
+    }
+    // 清零在锁外进行, 页面仍标记为 PG_FREE
+    memset((void*)page, 0, PGSIZE);
+
+    spinlock_acquire(&zone.zlk);
+    if (zone.zcount < ZPOOL_MAX) {
+        zone.zpool[zone.zcount++] = page;
+        zone.zfilled++;
+        page = 0;
+    }
+    spinlock_release(&zone.zlk);
+
+    if (page) {
+        // 别的 hart 抢先填满了池, 把这一页还回去
+        region_put(1, &page);
+        return 0;
+    }
+    return 1;
+}
+
+// pmem_zero_refill: 由空闲的 hart 调用, 每次最多清零一页
+// 同时响应针对本CPU缓存的回收请求
+// 返回本次清零的页数, 为 0 表示没有可做的工作(调用者可以 wfi)
+int pmem_zero_refill(void) {
+    push_off();
+    pcp_get();
+    pop_off();
+    return zpool_refill();
 }
 
 // pmem_alloc_pages(: 分配多个物理页面)
 // 返回实际分配到的页数（<= n），把每一页的物理地址写到 pages[] 里
+// 先消耗本CPU缓存, 不足的部分持锁一次从全局链表取
 int pmem_alloc_pages(bool in_kernel, int n, uint64 pages[]) {
     if (n <= 0) return 0;
+    if (!watermark_ok(in_kernel, n)) {
+        return 0;
+    }
 
-    alloc_region_t* region = in_kernel ? &kern_region : &user_region;
     int allocated = 0;
 
-    spinlock_acquire(&region->lk);
-    while (allocated < n && region->list_head.next) {
-        page_node_t* node = region->list_head.next;
-        region->list_head.next = node->next;
-        region->allocable--;
-        pages[allocated++] = (uint64)node;
-
-        uint64 page = (uint64)node;
-        uint32 idx = page_index(region, page);
-        if (region->state[idx] == 0) {
-            // 理论上这里应该永远是 1（空闲），如果是 0 就说明 freelist 被破坏
-            // 你可以 panic 或者至少打印 warning
-        }
-        region->state[idx] = 0;  // 标记为“已分配”
+    push_off();
+    pcp_cache_t* pc = pcp_get();
+    while (allocated < n && pc->count > 0) {
+        pages[allocated++] = pc->pages[--pc->count];
+        pc->hits++;
+    }
+    pop_off();
+
+    if (allocated < n) {
+        allocated += region_take(n - allocated, pages + allocated);
     }
-    spinlock_release(&region->lk);
 
-    // 填充调试模式
     for (int i = 0; i < allocated; i++) {
-        memset((void*)pages[i], 5, PGSIZE);
+        mark_allocated(pages[i], in_kernel);
+    }
+    if (allocated > 0) {
+        watermark_check(in_kernel);
     }
     return allocated;
 }
-// pmem_free_pages_count: 获取可分配页面数
+
+// pmem_free_pages: 批量释放多个物理页面, 全局锁只获取一次
+void pmem_free_pages(bool in_kernel, int n, uint64 pages[]) {
+    if (n <= 0) return;
+
+    // 只把引用计数降到 0 的页面归还 (原地压缩数组)
+    int nfree = 0;
+    for (int i = 0; i < n; i++) {
+        if (mark_free(pages[i], in_kernel)) {
+            pages[nfree++] = pages[i];
+        }
+    }
+    region_put(nfree, pages);
+}
+
+// pmem_alloc_order: 分配 2^order 个物理上连续的页面, 首地址按块大小对齐
+// order 为 0 时等价于 pmem_alloc
+void* pmem_alloc_order(int order, bool in_kernel) {
+    if (order < 0 || order > PMEM_MAX_ORDER) {
+        return NULL;
+    }
+    if (order == 0) {
+        return pmem_alloc(in_kernel);
+    }
+    if (!watermark_ok(in_kernel, 1u << order)) {
+        return NULL;
+    }
+
+    spinlock_acquire(&zone.lk);
+    uint64 page = buddy_alloc(order);
+    spinlock_release(&zone.lk);
+
+    if (page == 0) {
+        // 连续块可能被CPU缓存和预清零池打散了, 回收后重试一次
+        zone_rebalance();
+        push_off();
+        pcp_get();
+        pop_off();
+        spinlock_acquire(&zone.lk);
+        page = buddy_alloc(order);
+        spinlock_release(&zone.lk);
+    }
+
+    if (page) {
+        for (uint32 i = 0; i < (1u << order); i++) {
+            mark_allocated(page + (uint64)i * PGSIZE, in_kernel);
+        }
+        watermark_check(in_kernel);
+    }
+    return (void*)page;
+}
+
+// pmem_free_order: 释放 pmem_alloc_order 分配的连续块, 与空闲伙伴合并
+void pmem_free_order(uint64 page, int order, bool in_kernel) {
+    if (order < 0 || order > PMEM_MAX_ORDER) {
+        panic("pmem_free_order: bad order");
+    }
+    if (order == 0) {
+        pmem_free(page, in_kernel);
+        return;
+    }
+    if (page % ((uint64)PGSIZE << order) != 0) {
+        panic("pmem_free_order: block not aligned");
+    }
+
+    for (uint32 i = 0; i < (1u << order); i++) {
+        if (!mark_free(page + (uint64)i * PGSIZE, in_kernel)) {
+            panic("pmem_free_order: block is shared");
+        }
+    }
+    spinlock_acquire(&zone.lk);
+    buddy_free(page, order);
+    spinlock_release(&zone.lk);
+}
+
+// pmem_owner: 查询一个已分配页面的用途
+// 返回 1 表示内核页, 0 表示用户页, -1 表示不是 zone 中已分配的页面
+int pmem_owner(uint64 page) {
+    if ((page % PGSIZE) != 0 || page < zone.begin || page >= zone.end) {
+        return -1;
+    }
+    uint8 flags = zone.meta[page_index(page)].flags;
+    if (flags & PG_FREE) {
+        return -1;
+    }
+    return (flags & PG_KERN) ? 1 : 0;
+}
+
+// pmem_ref_inc: 为一个已分配的页面增加一个引用 (例如 COW fork 共享页面)
+void pmem_ref_inc(uint64 page) {
+    if (pmem_owner(page) < 0) {
+        panic("pmem_ref_inc: page not allocated");
+    }
+    __sync_fetch_and_add(&zone.meta[page_index(page)].ref, 1);
+}
+
+// pmem_ref_count: 读取一个已分配页面的引用计数, 不是已分配页面时返回 0
+uint32 pmem_ref_count(uint64 page) {
+    if (pmem_owner(page) < 0) {
+        return 0;
+    }
+    return zone.meta[page_index(page)].ref;
+}
+
+// pmem_age / pmem_set_age: 读写已分配页面的年龄, 不是已分配页面时读到 0
+uint8 pmem_age(uint64 page) {
+    if (pmem_owner(page) < 0) {
+        return 0;
+    }
+    return zone.meta[page_index(page)].age;
+}
+
+void pmem_set_age(uint64 page, uint8 age) {
+    if (pmem_owner(page) < 0) {
+        return;
+    }
+    zone.meta[page_index(page)].age = age;
+}
+
+// pmem_pgtbl_count / pmem_pgtbl_count_add: 读取 / 调整页表页中非零 PTE 的数量
+// 同一张页表的修改由持有它的地址空间串行化, 不需要原子操作
+uint32 pmem_pgtbl_count(uint64 page) {
+    if (pmem_owner(page) != 1) {
+        panic("pmem_pgtbl_count: not a kernel page");
+    }
+    return zone.meta[page_index(page)].nptes;
+}
+
+void pmem_pgtbl_count_add(uint64 page, int delta) {
+    if (pmem_owner(page) != 1) {
+        panic("pmem_pgtbl_count_add: not a kernel page");
+    }
+    page_meta_t *m = &zone.meta[page_index(page)];
+    int n = (int)m->nptes + delta;
+    if (n < 0 || n > 512) {
+        panic("pmem_pgtbl_count_add: bad count");
+    }
+    m->nptes = (uint16)n;
+}
+
+// pmem_slab_index / pmem_set_slab_index: 多页 slab 中这一页是第几页 (与页表计数共用元数据)
+uint32 pmem_slab_index(uint64 page) {
+    if (pmem_owner(page) != 1) {
+        panic("pmem_slab_index: not a kernel page");
+    }
+    return zone.meta[page_index(page)].nptes;
+}
+
+void pmem_set_slab_index(uint64 page, uint32 idx) {
+    if (pmem_owner(page) != 1 || idx >= (1u << PMEM_MAX_ORDER)) {
+        panic("pmem_set_slab_index");
+    }
+    zone.meta[page_index(page)].nptes = (uint16)idx;
+}
+
+// pmem_free_pages_count: 获取某种用途还能分配的页面数
+// 即 zone 中的空闲页(包括各CPU缓存和预清零池)减去该用途的 min 水位线
 uint32 pmem_free_pages_count(bool in_kernel) {
-    alloc_region_t* region = in_kernel ? &kern_region : &user_region;
-    spinlock_acquire(&region->lk);
-    uint32 n = region->allocable;
-    spinlock_release(&region->lk);
-    return n;
+    spinlock_acquire(&zone.lk);
+    uint32 n = zone.allocable;
+    spinlock_release(&zone.lk);
+    spinlock_acquire(&zone.zlk);
+    n += zone.zcount;
+    spinlock_release(&zone.zlk);
+    for (int i = 0; i < NCPU; i++) {
+        n += zone.pcp[i].count;
+    }
+    uint32 min = zone.wmark[in_kernel].min;
+    return n > min ? n - min : 0;
+}
+
+// pmem_used_pages_count: 获取某种用途已分配的页面数
+uint32 pmem_used_pages_count(bool in_kernel) {
+    return zone.used[in_kernel];
+}
+
+// pmem_total_pages: zone 管理的物理页总数
+uint32 pmem_total_pages(void) {
+    return (zone.end - zone.begin) / PGSIZE;
 }
+
+// pmem_image_pages: 内核映像 (代码, 数据, bss) 和页面元数据占用的页数, 这部分不归 zone 管理
+uint32 pmem_image_pages(void) {
+    return (zone.begin - KERNEL_BASE) / PGSIZE;
+}
+
+// pmem_phystop: 物理内存的上界, 内核直接映射到这里为止
+uint64 pmem_phystop(void) {
+    return zone.end;
+}
+
+// pmem_pcp_stat: 读取某个CPU页面缓存的统计信息
+void pmem_pcp_stat(int cpu, pmem_pcp_stat_t* st) {
+    if (cpu < 0 || cpu >= NCPU || st == NULL) {
+        return;
+    }
+    pcp_cache_t* pc = &zone.pcp[cpu];
+    st->hits = pc->hits;
+    st->refills = pc->refills;
+    st->drains = pc->drains;
+    st->cached = pc->count;
+}
+
+// pmem_zero_stat: 读取预清零页池的统计信息
+void pmem_zero_stat(pmem_zero_stat_t* st) {
+    if (st == NULL) {
+        return;
+    }
+    spinlock_acquire(&zone.zlk);
+    st->hits = zone.zhits;
+    st->misses = zone.zmisses;
+    st->filled = zone.zfilled;
+    st->pooled = zone.zcount;
+    spinlock_release(&zone.zlk);
+}
+
+void pmem_print_stats(void) {
+    printf("\n=== PMEM per-CPU page cache ===\n");
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        pmem_pcp_stat_t st;
+        pmem_pcp_stat(cpu, &st);
+        printf(" cpu%d: hits=%lu refills=%lu drains=%lu cached=%u\n",
+               cpu, st.hits, st.refills, st.drains, st.cached);
+    }
+    printf(" free blocks by order:");
+    spinlock_acquire(&zone.lk);
+    for (int o = 0; o <= PMEM_MAX_ORDER; o++) {
+        printf(" %u", zone.nr_free[o]);
+    }
+    spinlock_release(&zone.lk);
+    printf("\n");
+
+    pmem_zero_stat_t zs;
+    pmem_zero_stat(&zs);
+    printf(" zero pool: hits=%lu misses=%lu filled=%lu pooled=%u\n",
+           zs.hits, zs.misses, zs.filled, zs.pooled);
+    for (int k = 1; k >= 0; k--) {
+        watermark_t* wm = &zone.wmark[k];
+        printf(" %s: used=%u free=%u wmark min=%u low=%u high=%u\n",
+               k ? "kern" : "user", pmem_used_pages_count(k), pmem_free_pages_count(k),
+               wm->min, wm->low, wm->high);
+    }
+    printf(" rebalances=%lu watermark fails=%lu\n", zone.rebalances, zone.wmark_fails);
+    printf("===============================\n");
+}
+
 // Helper function for external use
 int alloc_pages(int n, bool in_kernel, uint64 pages[]) {
     return pmem_alloc_pages(in_kernel, n, pages);
-}
\ No newline at end of file
+}
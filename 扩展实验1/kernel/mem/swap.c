@@ -0,0 +1,231 @@
+#include "mem/swap.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "dev/virtio_disk.h"
+#include "fs/bio.h"
+#include "fs/fs.h"
+#include "lib/lock.h"
+#include "lib/print.h"
+#include "lib/string.h"
+#include "memlayout.h"
+#include "proc/proc.h"
+
+// 交换槽数量的上限 (每槽一页, 4096 槽即 16 MiB)
+#define SWAP_MAX_SLOTS 4096
+// 一个槽占用的文件系统块数
+#define SWAP_SLOT_BLOCKS (PGSIZE / BSIZE)
+
+static struct {
+    spinlock_t lock;      // 保护 ref 和统计
+    sleeplock_t io;       // 串行化换入换出, 也保护时钟指针和 buf
+    uint32 start;         // 交换区的第一个块号
+    uint32 nslots;
+    uint8 ref[SWAP_MAX_SLOTS]; // 每个槽被多少个交换项引用 (fork 后可能大于 1)
+    int hand;             // 时钟指针: 正在扫描的进程下标
+    uint64 hand_va;       // 时钟指针: 该进程中下一个要检查的地址
+    struct buf buf;       // 读写磁盘用的缓冲, 不经过块缓存
+    swap_stat_t stat;
+} swap;
+
+void swap_init(void)
+{
+    spinlock_init(&swap.lock, "swap");
+    sleeplock_init(&swap.io, "swap_io");
+    swap.buf.dev = ROOTDEV;
+
+    // 交换区紧跟在文件系统之后, 一直延伸到磁盘末尾
+    uint64 disk_blocks = virtio_disk_capacity() / (BSIZE / 512);
+    swap.start = fs_superblock()->size;
+    uint64 n = disk_blocks > swap.start ? (disk_blocks - swap.start) / SWAP_SLOT_BLOCKS : 0;
+    if (n > SWAP_MAX_SLOTS) {
+        n = SWAP_MAX_SLOTS;
+    }
+    swap.nslots = (uint32)n;
+    swap.stat.nslots = swap.nslots;
+    if (swap.nslots == 0) {
+        printf("[swap] no swap area on disk, swapping disabled\n");
+    } else {
+        printf("[swap] %u slots at block %u\n", swap.nslots, swap.start);
+    }
+}
+
+static int slot_alloc(void)
+{
+    spinlock_acquire(&swap.lock);
+    for (uint32 i = 0; i < swap.nslots; i++) {
+        if (swap.ref[i] == 0) {
+            swap.ref[i] = 1;
+            swap.stat.used++;
+            spinlock_release(&swap.lock);
+            return (int)i;
+        }
+    }
+    spinlock_release(&swap.lock);
+    return -1;
+}
+
+void swap_dup(pte_t pte)
+{
+    uint32 slot = PTE_TO_SWAP(pte);
+    spinlock_acquire(&swap.lock);
+    if (slot >= swap.nslots || swap.ref[slot] == 0 || swap.ref[slot] == 0xFF) {
+        panic("swap_dup");
+    }
+    swap.ref[slot]++;
+    spinlock_release(&swap.lock);
+}
+
+void swap_free(pte_t pte)
+{
+    uint32 slot = PTE_TO_SWAP(pte);
+    spinlock_acquire(&swap.lock);
+    if (slot >= swap.nslots || swap.ref[slot] == 0) {
+        panic("swap_free");
+    }
+    if (--swap.ref[slot] == 0) {
+        swap.stat.used--;
+    }
+    spinlock_release(&swap.lock);
+}
+
+// 在一个交换槽和物理页之间搬运数据, 调用者持有 swap.io
+static void swap_rw(uint32 slot, uint64 pa, int write)
+{
+    for (int i = 0; i < SWAP_SLOT_BLOCKS; i++) {
+        swap.buf.blockno = swap.start + slot * SWAP_SLOT_BLOCKS + i;
+        if (write) {
+            memmove(swap.buf.data, (void*)(pa + i * BSIZE), BSIZE);
+            virtio_disk_rw(&swap.buf, 1);
+        } else {
+            virtio_disk_rw(&swap.buf, 0);
+            memmove((void*)(pa + i * BSIZE), swap.buf.data, BSIZE);
+        }
+    }
+}
+
+struct clock_scan {
+    pte_t *pte;     // 选中的牺牲页
+    uint64 va;
+    bool cleared;   // 本轮清除过 PTE_A, 需要刷新 TLB 才能重新记录访问
+};
+
+// 时钟算法的一步: 只考虑进程独占的普通用户页, 共享页 (COW/共享映射) 没有反向映射, 不换出
+static int clock_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct clock_scan *c = arg;
+    if (level != 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U) || (*pte & PTE_IMG)) {
+        return 0;
+    }
+    uint64 pa = PTE_TO_PA(*pte);
+    if (pmem_owner(pa) != 0 || pmem_ref_count(pa) != 1) {
+        return 0;
+    }
+    swap.stat.scanned++;
+    // 工作集采样会清除 PTE_A, 本周期内访问过的页面 (年龄为 0) 同样给第二次机会
+    if ((*pte & PTE_A) || pmem_age(pa) == 0) {
+        *pte &= ~PTE_A;
+        pmem_set_age(pa, 1);
+        c->cleared = true;
+        swap.stat.referenced++;
+        return 0;
+    }
+    c->pte = pte;
+    c->va = va;
+    return -1;
+}
+
+// 只从睡眠中的进程和当前进程换出页面: 可运行的进程可能是在内核中修改页表时被时钟中断抢占的
+static bool swap_victim_ok(struct proc *p)
+{
+    return p->pagetable != NULL && (p->state == PROC_SLEEPING || p == myproc());
+}
+
+// swap_reclaim: 换出最多 npages 个页面, 返回实际换出的数量
+// 时钟指针在所有进程的 [0, sz) 上循环, 每个页面最多得到一次第二次机会
+int swap_reclaim(int npages)
+{
+    if (swap.nslots == 0) {
+        return 0;
+    }
+    sleeplock_acquire(&swap.io);
+    int done = 0;
+    int idle = 0;   // 连续扫描完却没有找到牺牲页的进程数
+    while (done < npages && idle <= 2 * NPROC) {
+        struct proc *p = &proc_table[swap.hand];
+        struct clock_scan c = { 0 };
+        int r = 0;
+        spinlock_acquire(&p->lock);
+        if (swap_victim_ok(p) && swap.hand_va < p->sz) {
+            r = vm_range_walk(p->pagetable, swap.hand_va, PG_ROUND_UP(p->sz), 0, clock_leaf, &c);
+        }
+        if (c.cleared) {
+            uvm_tlb_flush(p);
+        }
+        if (r < 0) {
+            int slot = slot_alloc();
+            if (slot < 0) {
+                spinlock_release(&p->lock);
+                break;
+            }
+            // 先把 PTE 换成交换项, 进程之后的访问会在 swap_in 中等待这次写出完成
+            uint64 pa = PTE_TO_PA(*c.pte);
+            *c.pte = SWAP_TO_PTE(slot, PTE_FLAGS(*c.pte));
+            uvm_tlb_flush(p);
+            swap.hand_va = c.va + PGSIZE;
+            spinlock_release(&p->lock);
+
+            swap_rw(slot, pa, 1);
+            pmem_free(pa, false);
+            __sync_fetch_and_add(&swap.stat.swapouts, 1);
+            done++;
+            idle = 0;
+            continue;
+        }
+        spinlock_release(&p->lock);
+        swap.hand = (swap.hand + 1) % NPROC;
+        swap.hand_va = 0;
+        idle++;
+    }
+    sleeplock_release(&swap.io);
+    return done;
+}
+
+// swap_in: 把 va 所在的交换项读回内存, 成功 (或已被别人处理) 返回 0
+int swap_in(struct proc *p, uint64 va)
+{
+    // 先分配物理页: 分配可能需要换出别的页面, 不能在持有 swap.io 时进行
+    void *mem = uvm_alloc_page(false);
+    if (mem == NULL) {
+        return -1;
+    }
+    sleeplock_acquire(&swap.io);
+    pte_t *pte = vm_getpte(p->pagetable, va, false);
+    if (pte == NULL || !PTE_IS_SWAP(*pte)) {
+        // 等待期间这一项已经变化, 让调用者重新访问
+        sleeplock_release(&swap.io);
+        pmem_free((uint64)mem, false);
+        return 0;
+    }
+    pte_t old = *pte;
+    swap_rw(PTE_TO_SWAP(old), (uint64)mem, 0);
+    *pte = PA_TO_PTE(mem) | PTE_FLAGS(old) | PTE_V | PTE_A;
+    swap_free(old);
+    __sync_fetch_and_add(&swap.stat.swapins, 1);
+    sleeplock_release(&swap.io);
+    return 0;
+}
+
+void swap_get_stat(swap_stat_t *st)
+{
+    spinlock_acquire(&swap.lock);
+    *st = swap.stat;
+    spinlock_release(&swap.lock);
+}
+
+void swap_print_stats(void)
+{
+    swap_stat_t st;
+    swap_get_stat(&st);
+    printf("[swap] slots=%u used=%u swapouts=%llu swapins=%llu scanned=%llu referenced=%llu\n",
+           st.nslots, st.used, st.swapouts, st.swapins, st.scanned, st.referenced);
+}
@@ -0,0 +1,236 @@
+#include "mem/vmalloc.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "lib/lock.h"
+#include "lib/print.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "proc/cpu.h"
+
+#define VMALLOC_MAX_AREAS 64
+
+// 区域的状态
+//   UNUSED   表项空闲
+//   USED     已分配, 映射有效
+//   LAZY     已 vfree, 映射已解除, 地址仍保留
+//   FLUSHING 已清理: 等其他 hart 刷新 TLB 之后地址才能重用
+enum { AREA_UNUSED, AREA_USED, AREA_LAZY, AREA_FLUSHING };
+
+struct vm_area {
+    uint64 va;
+    uint32 npages;   // 不含后面的保护页
+    uint8 state;
+};
+
+static struct {
+    spinlock_t lock;                 // 保护区域表, 也串行化对内核页表中 vmalloc 区域的修改
+    struct vm_area areas[VMALLOC_MAX_AREAS];
+    volatile uint32 online;          // 已启用分页的 hart
+    volatile uint32 flush_pending;   // 每个 hart 一位: 还需要在时钟中断中整体刷新一次 TLB
+    vmalloc_stat_t stat;
+} vmap;
+
+void vmalloc_init(void)
+{
+    spinlock_init(&vmap.lock, "vmalloc");
+}
+
+// vmalloc_inithart: 本 hart 已经启用了内核页表, 之后的清理需要等它刷新 TLB
+void vmalloc_inithart(void)
+{
+    __sync_fetch_and_or(&vmap.online, 1u << mycpuid());
+}
+
+// vmalloc_tlb_sync: 时钟中断中调用, 完成本 hart 待处理的刷新
+void vmalloc_tlb_sync(void)
+{
+    uint32 bit = 1u << mycpuid();
+    if (vmap.flush_pending & bit) {
+        sfence_vma();
+        __sync_fetch_and_and(&vmap.flush_pending, ~bit);
+        __sync_fetch_and_add(&vmap.stat.remote_flushes, 1);
+    }
+}
+
+// 所有 hart 都已刷新: 上一次清理的地址可以重用了; 调用者持有 vmap.lock
+static void reclaim_flushed(void)
+{
+    if (vmap.flush_pending != 0) {
+        return;
+    }
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        if (vmap.areas[i].state == AREA_FLUSHING) {
+            vmap.areas[i].state = AREA_UNUSED;
+        }
+    }
+}
+
+// purge: 把延迟的区域转入 FLUSHING, 本 hart 立即刷新, 其他 hart 记下待刷新; 调用者持有 vmap.lock
+// 上一次清理还没有被所有 hart 确认时不开始新的一轮
+static void purge(void)
+{
+    if (vmap.flush_pending != 0) {
+        return;
+    }
+    sfence_vma();
+    uint32 others = vmap.online & ~(1u << mycpuid());
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        if (vmap.areas[i].state == AREA_LAZY) {
+            vmap.areas[i].state = others ? AREA_FLUSHING : AREA_UNUSED;
+        }
+    }
+    vmap.stat.lazy_pages = 0;
+    vmap.flush_pending = others;
+    vmap.stat.purges++;
+}
+
+// find_va: 首次适配, 找一段 npages 页再加一个保护页的空闲地址; 调用者持有 vmap.lock
+static uint64 find_va(uint32 npages)
+{
+    uint64 len = ((uint64)npages + 1) * PGSIZE;
+    uint64 va = VMALLOC_BASE;
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        struct vm_area *a = &vmap.areas[i];
+        if (a->state == AREA_UNUSED) {
+            continue;
+        }
+        uint64 end = a->va + ((uint64)a->npages + 1) * PGSIZE;
+        if (a->va < va + len && va < end) {
+            // 和这一段重叠: 从它后面重新开始检查
+            va = end;
+            i = -1;
+            if (va + len > VMALLOC_END) {
+                return 0;
+            }
+        }
+    }
+    return va + len <= VMALLOC_END ? va : 0;
+}
+
+static struct vm_area* find_slot(void)
+{
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        if (vmap.areas[i].state == AREA_UNUSED) {
+            return &vmap.areas[i];
+        }
+    }
+    return NULL;
+}
+
+static int vmap_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    if (level > 0) {
+        return VM_RANGE_DESCEND;
+    }
+    void *page = pmem_alloc(true);
+    if (page == NULL) {
+        return -1;
+    }
+    *pte = PA_TO_PTE(page) | PTE_R | PTE_W | PTE_G | PTE_V;
+    return 0;
+}
+
+static int vunmap_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    if (level > 0) {
+        panic("vunmap: huge leaf");
+    }
+    pmem_free(PTE_TO_PA(*pte), true);
+    *pte = 0;
+    return 0;
+}
+
+// vunmap: 解除映射并释放物理页, 不刷新 TLB; 页表页留给以后的分配, 不回收
+static void vunmap(uint64 va, uint32 npages)
+{
+    vm_range_walk(kvm_pgtbl(), va, va + (uint64)npages * PGSIZE, 0, vunmap_leaf, NULL);
+}
+
+// vmalloc: 分配 size 字节 (按页向上取整) 的内核缓冲区, 失败返回 NULL
+void* vmalloc(uint64 size)
+{
+    uint64 npages = PG_ROUND_UP(size) / PGSIZE;
+    if (npages == 0 || npages > (VMALLOC_END - VMALLOC_BASE) / PGSIZE) {
+        return NULL;
+    }
+    spinlock_acquire(&vmap.lock);
+    reclaim_flushed();
+    struct vm_area *a = find_slot();
+    uint64 va = a ? find_va(npages) : 0;
+    if (va == 0) {
+        // 地址或表项不够: 清理一次延迟的区域, 所有 hart 都已确认时可以立即重用
+        purge();
+        reclaim_flushed();
+        a = find_slot();
+        va = a ? find_va(npages) : 0;
+    }
+    if (va == 0) {
+        vmap.stat.fails++;
+        spinlock_release(&vmap.lock);
+        return NULL;
+    }
+    uint64 end = va + npages * PGSIZE;
+    if (vm_range_walk(kvm_pgtbl(), va, end, VM_RANGE_ALLOC, vmap_leaf, NULL) < 0) {
+        // 物理页不够: 退回已经映射的部分 (只在本 hart 上访问过这些 PTE)
+        vunmap(va, npages);
+        sfence_vma();
+        vmap.stat.fails++;
+        spinlock_release(&vmap.lock);
+        return NULL;
+    }
+    a->va = va;
+    a->npages = npages;
+    a->state = AREA_USED;
+    vmap.stat.areas++;
+    vmap.stat.pages += npages;
+    vmap.stat.allocs++;
+    spinlock_release(&vmap.lock);
+    // 这段地址之前要么从未映射, 要么已被所有 hart 刷新过, 只需刷新本 hart 可能缓存的无效项
+    sfence_vma();
+    return (void*)va;
+}
+
+// vfree: 释放 vmalloc 得到的缓冲区, addr 为 NULL 时什么也不做
+void vfree(void *addr)
+{
+    if (addr == NULL) {
+        return;
+    }
+    spinlock_acquire(&vmap.lock);
+    struct vm_area *a = NULL;
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        if (vmap.areas[i].state == AREA_USED && vmap.areas[i].va == (uint64)addr) {
+            a = &vmap.areas[i];
+            break;
+        }
+    }
+    if (a == NULL) {
+        panic("vfree: not a vmalloc address");
+    }
+    vunmap(a->va, a->npages);
+    a->state = AREA_LAZY;
+    vmap.stat.areas--;
+    vmap.stat.pages -= a->npages;
+    vmap.stat.lazy_pages += a->npages;
+    vmap.stat.frees++;
+    if (vmap.stat.lazy_pages >= VMALLOC_LAZY_MAX) {
+        reclaim_flushed();
+        purge();
+    }
+    spinlock_release(&vmap.lock);
+}
+
+void vmalloc_get_stat(vmalloc_stat_t *st)
+{
+    spinlock_acquire(&vmap.lock);
+    *st = vmap.stat;
+    spinlock_release(&vmap.lock);
+}
+
+void vmalloc_print_stats(void)
+{
+    vmalloc_stat_t st;
+    vmalloc_get_stat(&st);
+    printf("[vmalloc] areas=%u pages=%u lazy_pages=%u allocs=%llu frees=%llu fails=%llu purges=%llu remote_flushes=%llu\n",
+           st.areas, st.pages, st.lazy_pages, st.allocs, st.frees, st.fails, st.purges, st.remote_flushes);
+}
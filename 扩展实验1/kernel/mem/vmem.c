@@ -11,84 +11,401 @@
 #include "lib/lock.h"
 #include "memlayout.h"
 #include "lib/print.h"  
+#include "proc/proc.h"
+#include "mem/mmap.h"
+#include "mem/swap.h"
+
+#define UVM_FREE_BATCH 16
+
+// 写时复制的统计信息 (原子更新)
+static struct {
+    uint64 shared;   // fork 时共享(而不是复制)的页数
+    uint64 faults;   // 对 COW 页面的写入次数
+    uint64 copies;   // 需要复制页面的次数
+    uint64 reuses;   // 只剩一个引用, 直接恢复写权限的次数
+} cow_stat;
+
+// 用户 2MiB 大页的统计信息 (原子更新)
+static struct {
+    uint64 mapped;   // 当前仍以大页叶子映射的数量
+    uint64 faults;   // 缺页时直接建立大页的次数
+    uint64 demotes;  // 大页被拆回 4KiB 页的次数 (部分解除, fork 写时复制)
+    uint64 fallbacks;// 区间满足条件但分不到连续 2MiB, 退回 4KiB 页的次数
+} thp_stat;
+
+// 共享零页: 对从未写过的匿名页面的读访问都映射到这一页 (只读 + PTE_COW),
+// 第一次写入时由 uvm_cow_fault 换成私有页。内核自己持有一个引用, 所以它永远不会被释放,
+// 引用计数减一就是指向它的映射数
+static uint64 zero_page;
+
+static struct {
+    uint64 faults;   // 用零页满足的读缺页次数
+    uint64 breaks;   // 零页映射被写入而换成私有页的次数
+} zero_stat;
 
 static pgtbl_t kernel_pgtbl;
+
+// 内核页表和所有用户页表占用的页表页数 (原子更新)
+static uint64 pgtbl_pages;
+
+static pgtbl_t pgtbl_alloc(void)
+{
+    pgtbl_t t = (pgtbl_t)pmem_alloc_zeroed(true);
+    if (t) {
+        __sync_fetch_and_add(&pgtbl_pages, 1);
+    }
+    return t;
+}
+
+static void pgtbl_free(uint64 pa)
+{
+    pmem_free(pa, true);
+    __sync_fetch_and_sub(&pgtbl_pages, 1);
+}
+
+// pte_count: 维护每张页表的非零 PTE 计数 (pmem 页元数据), pte 从 old 变为 val 时调用
+// 有效映射、指向下一级的表项和交换项都算非零; 计数降到 0 的页表在解除映射时回收
+static inline void pte_count(pte_t *pte, pte_t old, pte_t val)
+{
+    if ((old == 0) != (val == 0)) {
+        pmem_pgtbl_count_add(PG_ROUND_DOWN((uint64)pte), val ? 1 : -1);
+    }
+}
+
+// vm_pte_set: 在 vm_range_walk 的回调之外写一个 PTE, 同时维护所在页表的计数
+void vm_pte_set(pte_t *pte, pte_t val)
+{
+    pte_count(pte, *pte, val);
+    *pte = val;
+}
+
+// ASID 分配: 单调递增地发放, 用完后进入新的一代并要求所有 CPU 整体刷新一次 TLB
+// 进程记录自己 ASID 所属的代数, 代数过期时在返回用户态前重新分配
+static struct {
+    spinlock_t lock;
+    uint32 bits;            // 硬件支持的 ASID 位数 (0 表示不支持, 退化为每次切换都刷新)
+    uint32 max;             // 可用的最大 ASID
+    uint32 next;            // 下一个要发放的 ASID (ASID 0 留给内核)
+    uint64 generation;      // 当前代数, 从 1 开始
+    volatile uint32 flush_pending; // 每个 CPU 一位: 进入新一代后尚未整体刷新 TLB
+    uint64 allocs;          // 发放 ASID 的次数
+    uint64 rollovers;       // ASID 用完进入新一代的次数
+    uint64 asid_flushes;    // 按 ASID 刷新的次数
+} asid_ctl;
 extern char trampoline[];
 
 extern char etext[]; 
 
-pte_t* vm_getpte(pgtbl_t pgtbl, uint64 va, bool alloc)
+static void vm_tlb_sync(pgtbl_t pgtbl);
+
+// vm_walk: 查找 va 在第 level 级页表中的 PTE (level 0 即普通的 4KiB 叶子)
+// 途中遇到更高一级的大页叶子时直接返回它; leaf_level 非空时返回 PTE 实际所在的级别
+pte_t* vm_walk(pgtbl_t pgtbl, uint64 va, bool alloc, int level, int *leaf_level)
 {
     if(va >= VA_MAX) 
     {
         panic("vm_getpte: virtual address out of bound");
     }
 
-    for (int level = 2; level > 0; level--) {
-        pte_t* pte = &pgtbl[VA_TO_VPN(va, level)];
+    for (int l = 2; l > level; l--) {
+        pte_t* pte = &pgtbl[VA_TO_VPN(va, l)];
 
+        if ((*pte & PTE_V) && !PTE_CHECK(*pte)) {
+            // 大页叶子: 这一段地址已经整体映射, 不再向下查找
+            if (leaf_level) {
+                *leaf_level = l;
+            }
+            return pte;
+        }
         if (*pte & PTE_V) {
            pgtbl = (pgtbl_t)PTE_TO_PA(*pte);
         } 
         else 
         {
             if (alloc) {
-                pgtbl = (pgtbl_t)pmem_alloc(true); // 页表属于内核
+                pgtbl = pgtbl_alloc(); // 页表属于内核, 必须全为 0
                 if (pgtbl == NULL) {
                     return NULL; // 物理内存不足
                 }
-                memset(pgtbl, 0, PGSIZE);
                 // 在当前PTE中填入新页表的物理地址, 并设置有效位
                 // 注意: 指向下一级页表的PTE, 其R/W/X权限位必须为0
-                *pte = PA_TO_PTE(pgtbl) | PTE_V;
+                vm_pte_set(pte, PA_TO_PTE(pgtbl) | PTE_V);
             } else {
                 // 如果 alloc 为 false, 则直接返回 NULL
                 return NULL;
             }
         }
     }
-    return &pgtbl[VA_TO_VPN(va, 0)];
+    if (leaf_level) {
+        *leaf_level = level;
+    }
+    return &pgtbl[VA_TO_VPN(va, level)];
 }
-// vm_mappages: 在页表中创建一段虚拟地址到物理地址的映射
-// - pgtbl: 目标页表
-// - va:    虚拟地址起始
-// - pa:    物理地址起始
-// - len:   映射长度 (必须是 PGSIZE 的整数倍)
-// - perm:  权限位 (PTE_R, PTE_W, PTE_X)
-void vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm) {
-  if((va % PGSIZE) != 0){
-    panic("mappages: va not aligned");}
 
-  if((len % PGSIZE) != 0){
-    panic("mappages: size not aligned");}
+// vm_getpte: 查找 va 对应的最低级 PTE; 如果 va 落在大页中, 返回的是那个大页叶子
+pte_t* vm_getpte(pgtbl_t pgtbl, uint64 va, bool alloc)
+{
+    return vm_walk(pgtbl, va, alloc, 0, NULL);
+}
 
-  if(len == 0){
-    panic("mappages: size");}
-  
-    uint64 current_va = va;
-    uint64 end_va = va + len;
-    uint64 current_pa = pa;
-    pte_t* pte;
+// vm_split_into: 用页表页 t 把第 level 级的大页叶子拆成下一级的 512 个叶子, 权限不变
+// 用户大页由 pmem_alloc_order 分配, 每一页都有自己的引用计数, 拆开后可以逐页释放或共享
+static void vm_split_into(pte_t *pte, int level, pgtbl_t t)
+{
+    if (*pte & PTE_U) {
+        __sync_fetch_and_sub(&thp_stat.mapped, 1);
+        __sync_fetch_and_add(&thp_stat.demotes, 1);
+    }
+    uint64 pa = PTE_TO_PA(*pte);
+    uint64 flags = PTE_FLAGS(*pte);
+    uint64 step = VM_LEVEL_SIZE(level - 1);
+    for (int i = 0; i < 512; i++) {
+        t[i] = PA_TO_PTE(pa + (uint64)i * step) | flags;
+    }
+    pmem_pgtbl_count_add((uint64)t, 512);
+    *pte = PA_TO_PTE(t) | PTE_V;
+}
 
-    while (current_va < end_va) {
-        // 1. 获取当前虚拟地址对应的最低级PTE的地址
-        pte = vm_getpte(pgtbl, current_va, true);
+// vm_split_leaf: 分配一张页表页并拆开大页叶子, 内存不足时返回 -1
+static int vm_split_leaf(pte_t *pte, int level)
+{
+    pgtbl_t t = pgtbl_alloc();
+    if (t == NULL) {
+        return -1;
+    }
+    vm_split_into(pte, level, t);
+    return 0;
+}
 
-        if (pte == NULL) {
-            panic("vm_mappages: pmem_alloc failed");
+// vm_split_need: 要让 va 成为叶子映射的边界, 需要拆开几层大页 (va 不在大页内部时为 0)
+static int vm_split_need(pgtbl_t pgtbl, uint64 va)
+{
+    if (va >= VA_MAX) {
+        return 0;
+    }
+    int level;
+    pte_t *pte = vm_walk(pgtbl, va, false, 0, &level);
+    if (pte == NULL || !(*pte & PTE_V)) {
+        return 0;
+    }
+    int n = 0;
+    while (level > 0 && (va % VM_LEVEL_SIZE(level)) != 0) {
+        n++;
+        level--;
+    }
+    return n;
+}
+
+// vm_split_at: 用 pool 中预先分配的页表页拆开 va 所在的大页, 直到 va 成为叶子边界
+static void vm_split_at(pgtbl_t pgtbl, uint64 va, pgtbl_t *pool, int *n)
+{
+    if (va >= VA_MAX) {
+        return;
+    }
+    int level;
+    pte_t *pte = vm_walk(pgtbl, va, false, 0, &level);
+    while (pte && (*pte & PTE_V) && level > 0 && (va % VM_LEVEL_SIZE(level)) != 0) {
+        vm_split_into(pte, level, pool[--(*n)]);
+        pte = vm_walk(pgtbl, va, false, 0, &level);
+    }
+}
+
+// vm_split_range: VM_RANGE_SPLIT 遍历之前, 先拆开跨过 va 和 end 的大页
+// 需要的页表页 (每端最多两层) 全部分配成功后才动手, 失败时返回 -1, 页表保持原样;
+// 拆开不改变任何地址的翻译, 所以不需要刷新 TLB
+static int vm_split_range(pgtbl_t pgtbl, uint64 va, uint64 end)
+{
+    pgtbl_t pool[4];
+    int need = vm_split_need(pgtbl, va) + vm_split_need(pgtbl, end);
+    int n = 0;
+    for (; n < need; n++) {
+        if ((pool[n] = pgtbl_alloc()) == NULL) {
+            while (n > 0) {
+                pgtbl_free((uint64)pool[--n]);
+            }
+            return -1;
         }
-        if (*pte & PTE_V) {
-            // 如果该PTE已存在映射, 这是不允许的
-            panic("vm_mappages: remap");
+    }
+    vm_split_at(pgtbl, va, pool, &n);
+    vm_split_at(pgtbl, end, pool, &n);
+    // va 和 end 落在同一个大页中时, 拆开一次就满足了两端
+    while (n > 0) {
+        pgtbl_free((uint64)pool[--n]);
+    }
+    return 0;
+}
+
+// vm_free_leaf: 按 pmem 记录的用途释放一个叶子映射的物理内存 (4KiB 页或 2MiB 大页)
+static void vm_free_leaf(uint64 pa, int level, const char *err)
+{
+    int owner = pmem_owner(pa);
+    if (owner < 0) {
+        // 物理地址不是 pmem 分配出去的页面, 这是一个严重错误
+        panic(err);
+    }
+    if (level == 0) {
+        pmem_free(pa, owner);
+    } else if (level == 1) {
+        pmem_free_order(pa, PMEM_MAX_ORDER, owner);
+    } else {
+        panic("vm_free_leaf: cannot free a gigapage");
+    }
+}
+// range_call: 调用回调, 按回调对 PTE 的修改维护页表计数 (回调直接读写 *pte 即可)
+static inline int range_call(vm_range_fn fn, pte_t *pte, uint64 va, int level, void *arg)
+{
+    pte_t old = *pte;
+    int r = fn(pte, va, level, arg);
+    pte_count(pte, old, *pte);
+    return r;
+}
+
+// vm_range_level: vm_range_walk 在一张第 level 级页表上的工作, base 为这张页表覆盖的起始地址
+// 带 VM_RANGE_FREE 时, 下降之后计数降到 0 的子页表 (其中的映射都被回调解除了) 随即回收
+static int vm_range_level(pgtbl_t tbl, int level, uint64 base, uint64 va, uint64 end,
+                          int flags, vm_range_fn fn, void *arg)
+{
+    uint64 size = VM_LEVEL_SIZE(level);
+    for (int i = VA_TO_VPN(va, level); i < 512 && va < end; i++) {
+        pte_t *pte = &tbl[i];
+        uint64 slot = base + (uint64)i * size;
+        uint64 next = slot + size;
+        bool whole = (va == slot && end >= next);
+        int r;
+
+        if ((*pte & PTE_V) && (level == 0 || !PTE_CHECK(*pte))) {
+            // 叶子: 大页只覆盖了一部分时按需拆开, 拆开后当作页表继续下降;
+            // 回调对大页叶子返回 VM_RANGE_DESCEND 时也拆开, 再逐个交给回调
+            if (level == 0 || whole || !(flags & VM_RANGE_SPLIT)) {
+                if ((r = range_call(fn, pte, slot, level, arg)) < 0) {
+                    return r;
+                }
+                if (level == 0 || r != VM_RANGE_DESCEND) {
+                    va = next;
+                    continue;
+                }
+            }
+            if (vm_split_leaf(pte, level) < 0) {
+                return -1;
+            }
+        } else if (!(*pte & PTE_V)) {
+            if (!(flags & VM_RANGE_ALLOC)) {
+                // 整棵子树都不存在, 直接跳过; 最低一级的交换项按需交给回调
+                if (level == 0 && (flags & VM_RANGE_SWAP) && PTE_IS_SWAP(*pte)) {
+                    if ((r = range_call(fn, pte, slot, level, arg)) < 0) {
+                        return r;
+                    }
+                }
+                va = next;
+                continue;
+            }
+            if (level == 0 || whole) {
+                if ((r = range_call(fn, pte, slot, level, arg)) < 0) {
+                    return r;
+                }
+                if (level == 0 || r != VM_RANGE_DESCEND) {
+                    va = next;
+                    continue;
+                }
+            }
+            pgtbl_t t = pgtbl_alloc();
+            if (t == NULL) {
+                return -1;
+            }
+            vm_pte_set(pte, PA_TO_PTE(t) | PTE_V);
+        }
+
+        uint64 sub_end = end < next ? end : next;
+        uint64 child = PTE_TO_PA(*pte);
+        r = vm_range_level((pgtbl_t)child, level - 1, slot, va, sub_end, flags, fn, arg);
+        if ((flags & VM_RANGE_FREE) && pmem_pgtbl_count(child) == 0) {
+            // 调用者在解除映射后会同步 TLB, 页表缓存中的旧表项随之失效
+            vm_pte_set(pte, 0);
+            pgtbl_free(child);
+        }
+        if (r < 0) {
+            return r;
         }
+        va = next;
+    }
+    return 0;
+}
+
+// vm_range_walk: 对 [va, end) 中的叶子 PTE 逐个调用 fn, 每张页表只访问一次
+// 返回 0 表示成功, 负数为回调返回的错误或页表分配失败 (-1)
+int vm_range_walk(pgtbl_t pgtbl, uint64 va, uint64 end, int flags, vm_range_fn fn, void *arg)
+{
+    if ((va % PGSIZE) != 0 || (end % PGSIZE) != 0) {
+        panic("vm_range_walk: range not aligned");
+    }
+    if (end > VA_MAX) {
+        panic("vm_range_walk: virtual address out of bound");
+    }
+    if (va >= end) {
+        return 0;
+    }
+    // 边界上的大页先拆开, 之后的遍历不再需要分配页表: 分配失败时还没有调用过回调
+    if ((flags & VM_RANGE_SPLIT) && vm_split_range(pgtbl, va, end) < 0) {
+        return -1;
+    }
+    return vm_range_level(pgtbl, 2, 0, va, end, flags, fn, arg);
+}
+
+struct map_args {
+    uint64 va;
+    uint64 pa;
+    int perm;
+};
+
+static int map_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct map_args *m = arg;
+    uint64 pa = m->pa + (va - m->va);
+    if (*pte & PTE_V) {
+        // 如果该PTE已存在映射, 这是不允许的
+        panic("vm_mappages: remap");
+    }
+    if (level > 0 && ((m->perm & PTE_U) || (pa % VM_LEVEL_SIZE(level)) != 0)) {
+        return VM_RANGE_DESCEND;
+    }
+    // 设置PTE, 包含物理页号, 权限位和有效位
+    *pte = PA_TO_PTE(pa) | m->perm | PTE_V;
+    return 0;
+}
 
-        // 2. 设置PTE, 包含物理页号, 权限位和有效位
-        *pte = PA_TO_PTE(current_pa) | perm | PTE_V;
+// vm_mappages: 在页表中创建一段虚拟地址到物理地址的映射
+// - pgtbl: 目标页表
+// - va:    虚拟地址起始
+// - pa:    物理地址起始
+// - len:   映射长度 (必须是 PGSIZE 的整数倍)
+// - perm:  权限位 (PTE_R, PTE_W, PTE_X)
+// 内核映射在 va/pa 对齐且剩余长度足够时自动使用 2MiB/1GiB 大页叶子;
+// 用户映射仍逐页建立 (uvm* 按 4KiB 页管理引用计数)
+void vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm) {
+    if ((va % PGSIZE) != 0) {
+        panic("mappages: va not aligned");
+    }
+    if ((len % PGSIZE) != 0) {
+        panic("mappages: size not aligned");
+    }
+    if (len == 0) {
+        panic("mappages: size");
+    }
+    struct map_args m = { va, pa, perm };
+    if (vm_range_walk(pgtbl, va, va + len, VM_RANGE_ALLOC, map_leaf, &m) < 0) {
+        panic("vm_mappages: pmem_alloc failed");
+    }
+}
 
-        // 3. 移动到下一个页面
-        current_va += PGSIZE;
-        current_pa += PGSIZE;
+static int unmap_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    if (*(bool*)arg && !(*pte & PTE_IMG)) {
+        // 释放其对应的物理页 (用途记录在 pmem 的元数据中)
+        vm_free_leaf(PTE_TO_PA(*pte), level, "vm_unmappages: pa is not an allocated page");
     }
+    // 将PTE清零, 使映射失效
+    *pte = 0;
+    return 0;
 }
 
 // vm_unmappages: 在页表中解除一段地址映射
@@ -96,76 +413,89 @@ void vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm) {
 // - va:     虚拟地址起始
 // - len:    映射长度
 // - freeit: 是否释放映射对应的物理页面
-void vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit) {
+// 只被覆盖一部分的大页先拆成下一级, 未映射的部分直接跳过, 变空的页表页一并回收
+// 拆大页时分配不到页表页返回 -1, 此时没有解除任何映射
+int vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit) {
     if ((va % PGSIZE) != 0) {
         panic("vm_unmappages: va not aligned");
     }
     if ((len % PGSIZE) != 0) {
         panic("vm_unmappages: length not aligned");
     }
-    uint64 current_va = va;
-    uint64 end_va = va + len;
-    pte_t* pte;
-
-    while (current_va < end_va) {
-        // 1. 获取当前虚拟地址对应的最低级PTE的地址 (不分配新页表)
-        pte = vm_getpte(pgtbl, current_va, false);
-
-        if (pte != NULL && (*pte & PTE_V)) {
-            // 2. 如果映射存在
-            if (freeit) {
-                // 3. 如果需要, 释放其对应的物理页
-                uint64 pa = PTE_TO_PA(*pte);
-                // 根据物理地址 pa 判断它属于哪个区域
-                if (pa >= PG_ROUND_UP((uint64)ALLOC_BEGIN) && pa < PG_ROUND_UP((uint64)ALLOC_BEGIN) + 1024 * PGSIZE) {
-                    // 物理地址在内核区
-                    pmem_free(pa, true);
-                } else if (pa >= PG_ROUND_UP((uint64)ALLOC_BEGIN) + 1024 * PGSIZE && pa < PHYSTOP) {
-                    // 物理地址在用户区
-                    pmem_free(pa, false);
-                } else {
-                    // 物理地址不在任何一个可管理区域内, 这是一个严重错误   
-                    panic("vm_unmappages: pa out of any known region");
-                }
-            }
-            // 4. 将PTE清零, 使映射失效
-            *pte = 0;
-        }
-
-        // 5. 移动到下一个页面
-        current_va += PGSIZE;
+    if (vm_range_walk(pgtbl, va, va + len, VM_RANGE_SPLIT | VM_RANGE_FREE, unmap_leaf, &freeit) < 0) {
+        return -1;
     }
+    vm_tlb_sync(pgtbl);
+    return 0;
 }
 
 
+// vm_count: 统计页表树中的页表页数, 以及每一级的叶子 PTE 数
+static void vm_count(pgtbl_t pgtbl, int level, uint64 *tables, uint64 leaves[3])
+{
+    (*tables)++;
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pgtbl[i];
+        if (!(pte & PTE_V)) {
+            continue;
+        }
+        if (PTE_CHECK(pte) && level > 0) {
+            vm_count((pgtbl_t)PTE_TO_PA(pte), level - 1, tables, leaves);
+        } else {
+            leaves[level]++;
+        }
+    }
+}
+
 void kvm_init() {
     // 1. 为顶级页表分配一个物理页
-    kernel_pgtbl = (pgtbl_t)pmem_alloc(true);
+    kernel_pgtbl = pgtbl_alloc();
     if (kernel_pgtbl == NULL) {
         panic("kvm_init: failed to allocate root page table");
     }
-    memset(kernel_pgtbl, 0, PGSIZE);
 
     // 2. 映射硬件设备: UART / VirtIO
-    vm_mappages(kernel_pgtbl, UART_BASE, UART_BASE, PGSIZE, PTE_R | PTE_W);
-    vm_mappages(kernel_pgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+    // 内核页表中的映射全部标记为全局 (PTE_G), 用户 ASID 的刷新不会波及它们
+    vm_mappages(kernel_pgtbl, UART_BASE, UART_BASE, PGSIZE, PTE_R | PTE_W | PTE_G);
+    vm_mappages(kernel_pgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W | PTE_G);
     
 
     // 3. 映射硬件设备: PLIC
     // 将 PLIC 寄存器的物理地址区域映射到等值的虚拟地址
-    vm_mappages(kernel_pgtbl, PLIC_BASE, PLIC_BASE, 0x400000, PTE_R | PTE_W);
+    vm_mappages(kernel_pgtbl, PLIC_BASE, PLIC_BASE, 0x400000, PTE_R | PTE_W | PTE_G);
     
     // 4. 映射内核代码段 (.text)
     // 权限为 可读 | 可执行 (R-X)
-    vm_mappages(kernel_pgtbl, KERNEL_BASE, KERNEL_BASE, (uint64)etext - KERNEL_BASE, PTE_R | PTE_X);
+    vm_mappages(kernel_pgtbl, KERNEL_BASE, KERNEL_BASE, (uint64)etext - KERNEL_BASE, PTE_R | PTE_X | PTE_G);
 
     // 5. 映射内核数据段和剩余的所有物理内存
     // 权限为 可读 | 可写 (RW-)
     uint64 pa_for_data = (uint64)etext;
-    vm_mappages(kernel_pgtbl, pa_for_data, pa_for_data, PHYSTOP - pa_for_data, PTE_R | PTE_W);
+    vm_mappages(kernel_pgtbl, pa_for_data, pa_for_data, pmem_phystop() - pa_for_data, PTE_R | PTE_W | PTE_G);
 
     // 6. 映射 trampoline (供用户态/内核态切换使用)
-    vm_mappages(kernel_pgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+    vm_mappages(kernel_pgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
+
+    // 7. 分配共享零页 (按用户页记账, 与用户页表中的映射一起按引用计数管理)
+    zero_page = (uint64)pmem_alloc_zeroed(false);
+    if (zero_page == 0) {
+        panic("kvm_init: failed to allocate the zero page");
+    }
+
+    // 8. 统计直接映射使用大页后节省的页表页
+    uint64 tables = 0;
+    uint64 leaves[3] = {0, 0, 0};
+    vm_count(kernel_pgtbl, 2, &tables, leaves);
+    // 只用 4KiB 叶子时, 每个 2MiB 叶子需要一个 L0 页表, 每个 1GiB 叶子需要 1 + 512 个
+    uint64 tables_4k = tables + leaves[1] + leaves[2] * (1 + 512);
+    printf("kvm: %lu page-table pages (leaves 4K=%lu 2M=%lu 1G=%lu), 4K-only would need %lu, saved %lu\n",
+           tables, leaves[0], leaves[1], leaves[2], tables_4k, tables_4k - tables);
+}
+
+// kvm_pgtbl: 内核页表, 供 vmalloc 在其中建立映射
+pgtbl_t kvm_pgtbl(void)
+{
+    return kernel_pgtbl;
 }
 
 // kvm_inithart: 在每个CPU核上启用分页
@@ -179,6 +509,122 @@ void kvm_inithart() {
     // 2. 刷新 TLB (Translation Lookaside Buffer)
     // 确保旧的/无效的地址翻译被清除
     sfence_vma();
+
+    // 3. 探测硬件支持的 ASID 位数: 写入全 1 后读回仍为 1 的位即为可用位
+    w_satp(MAKE_SATP_ASID(kernel_pgtbl, SATP_ASID_MASK));
+    uint64 mask = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+    w_satp(MAKE_SATP(kernel_pgtbl));
+    sfence_vma();
+    uint32 bits = 0;
+    while (bits < 16 && (mask & (1ul << bits))) {
+        bits++;
+    }
+#ifdef VM_NO_ASID
+    bits = 0;
+#endif
+    if (mycpuid() == 0) {
+        spinlock_init(&asid_ctl.lock, "asid");
+        asid_ctl.bits = bits;
+        asid_ctl.max = bits ? (1u << bits) - 1 : 0;
+        asid_ctl.next = 1;
+        asid_ctl.generation = 1;
+        printf("kvm: %u ASID bits\n", bits);
+    } else if (bits < asid_ctl.bits) {
+        // 各 hart 的 ASID 位数不同时取最小值
+        asid_ctl.bits = bits;
+        asid_ctl.max = bits ? (1u << bits) - 1 : 0;
+    }
+}
+
+// uvm_satp: 返回用户态之前调用 (已关中断), 计算进程 p 的 satp
+// - ASID 代数过期或尚未分配时重新分配, 用完则进入新的一代
+// - 本 CPU 有待处理的整体刷新或本进程的延迟刷新时, 在这里完成
+// flush 置 1 表示硬件不支持 ASID, trampoline 切换 satp 后必须整体刷新
+uint64 uvm_satp(struct proc *p, int *flush)
+{
+    if (asid_ctl.bits == 0) {
+        *flush = 1;
+        return MAKE_SATP(p->pagetable);
+    }
+    *flush = 0;
+
+    int cpu = mycpuid();
+    if (p->asid_gen != asid_ctl.generation) {
+        spinlock_acquire(&asid_ctl.lock);
+        if (p->asid_gen != asid_ctl.generation) {
+            if (asid_ctl.next > asid_ctl.max) {
+                // ASID 用完: 进入新一代, 所有 CPU 在下次返回用户态前整体刷新一次
+                asid_ctl.generation++;
+                asid_ctl.next = 1;
+                asid_ctl.rollovers++;
+                asid_ctl.flush_pending = (1u << NCPU) - 1;
+            }
+            p->asid = asid_ctl.next++;
+            p->asid_gen = asid_ctl.generation;
+            p->tlb_stale = 0;
+            asid_ctl.allocs++;
+        }
+        spinlock_release(&asid_ctl.lock);
+    }
+
+    if (asid_ctl.flush_pending & (1u << cpu)) {
+        __sync_fetch_and_and(&asid_ctl.flush_pending, ~(1u << cpu));
+        sfence_vma();
+    }
+    if (p->tlb_stale & (1u << cpu)) {
+        __sync_fetch_and_and(&p->tlb_stale, ~(1u << cpu));
+        sfence_vma_asid(p->asid);
+        __sync_fetch_and_add(&asid_ctl.asid_flushes, 1);
+    }
+    return MAKE_SATP_ASID(p->pagetable, p->asid);
+}
+
+// uvm_tlb_flush: 进程 p 的映射被解除或降权后调用
+// 本 CPU 立即按 ASID 刷新, 其他 CPU 记在 p->tlb_stale 中, 下次运行 p 之前再刷新
+void uvm_tlb_flush(struct proc *p)
+{
+    if (asid_ctl.bits == 0) {
+        // 不支持 ASID 时每次进入用户态都会整体刷新, 这里只需处理本 CPU
+        sfence_vma();
+        return;
+    }
+    if (p->asid == 0) {
+        return;
+    }
+    push_off();
+    int cpu = mycpuid();
+    sfence_vma_asid(p->asid);
+    __sync_fetch_and_or(&p->tlb_stale, ((1u << NCPU) - 1) & ~(1u << cpu));
+    pop_off();
+    __sync_fetch_and_add(&asid_ctl.asid_flushes, 1);
+}
+
+// uvm_asid_reset: 进程换了新页表 (exec), 让它在下次返回用户态时领取新的 ASID
+void uvm_asid_reset(struct proc *p)
+{
+    p->asid_gen = 0;
+}
+
+void uvm_print_asid_stats(void)
+{
+    printf("\n=== ASID ===\n");
+    printf(" bits=%u generation=%lu allocs=%lu rollovers=%lu asid_flushes=%lu\n",
+           asid_ctl.bits, asid_ctl.generation, asid_ctl.allocs, asid_ctl.rollovers,
+           asid_ctl.asid_flushes);
+    printf("============\n");
+}
+
+// vm_tlb_sync: 页表 pgtbl 中的映射被解除或降权后刷新 TLB
+// 当前进程的页表按 ASID 刷新; 内核页表整体刷新;
+// 其他进程的页表要么还没运行过, 要么正在被销毁 (它的 ASID 不会在本代内再发放), 无需刷新
+static void vm_tlb_sync(pgtbl_t pgtbl)
+{
+    struct proc *p = myproc();
+    if (p && p->pagetable == pgtbl) {
+        uvm_tlb_flush(p);
+    } else if (pgtbl == kernel_pgtbl) {
+        sfence_vma();
+    }
 }
 
 // 计算虚拟地址范围
@@ -201,7 +647,7 @@ static const char* get_region_name(uint64 va, uint64 pa) {
     if (va == VIRTIO0) return "VIRTIO";
     if (va >= PLIC_BASE && va < PLIC_BASE + 0x400000) return "PLIC";
     if (va >= KERNEL_BASE && va < (uint64)etext) return "KERNEL_TEXT";
-    if (va >= (uint64)etext && va < PHYSTOP) return "KERNEL_DATA";
+    if (va >= (uint64)etext && va < pmem_phystop()) return "KERNEL_DATA";
     //if (va == TRAMPOLINE) return "TRAMPOLINE";
     return "UNKNOWN";
 }
@@ -228,6 +674,10 @@ static void vm_print_recursive_new(pgtbl_t pgtbl, int level, int indices[3]) {
         if (!(pte & PTE_V)) continue;
         
         indices[level] = i;
+        // 大页叶子覆盖了更低级的全部索引
+        for (int l = level - 1; l >= 0; l--) {
+            indices[l] = 0;
+        }
         
         if (PTE_CHECK(pte) && level > 0) {
             // 非叶子节点，继续递归
@@ -244,7 +694,8 @@ static void vm_print_recursive_new(pgtbl_t pgtbl, int level, int indices[3]) {
             print_hex_padded(pa);
             printf(" | ");
             print_permissions(pte);
-            printf(" | %s\n", get_region_name(va, pa));
+            printf(" | %s%s\n", get_region_name(va, pa),
+                   level == 2 ? " [1G]" : level == 1 ? " [2M]" : "");
         }
     }
 }
@@ -276,25 +727,14 @@ static void vm_freewalk(pgtbl_t pgtbl, int level, bool free_leaf) {
             uint64 child_pa = PTE_TO_PA(pte);
             vm_freewalk((pgtbl_t)child_pa, level - 1, free_leaf);
 
-            // 子页表本身是通过 pmem_alloc(true) 分配的
-            pmem_free(child_pa, true);
+            // 子页表本身是通过 pgtbl_alloc 分配的
+            pgtbl_free(child_pa);
 
         } else {
-            // 叶子 PTE（level==0 或 R/W/X 非 0）
+            // 叶子 PTE（level==0 或 R/W/X 非 0, 后者是大页）
             if (free_leaf) {
-                uint64 pa = PTE_TO_PA(pte);
-
-                // 和 vm_unmappages 同一套逻辑：内核区 / 用户区
-                uint64 kbegin = PG_ROUND_UP((uint64)ALLOC_BEGIN);
-                uint64 ksplit = kbegin + 1024 * PGSIZE; // 或硬编码 1024*PGSIZE
-
-                if (pa >= kbegin && pa < ksplit) {
-                    pmem_free(pa, true);
-                } else if (pa >= ksplit && pa < PHYSTOP) {
-                    pmem_free(pa, false);
-                } else {
-                    panic("vm_freewalk: leaf pa out of known region");
-                }
+                // 和 vm_unmappages 同一套逻辑：按 pmem 记录的用途和叶子大小释放
+                vm_free_leaf(PTE_TO_PA(pte), level, "vm_freewalk: leaf pa is not an allocated page");
             }
         }
 
@@ -308,7 +748,7 @@ void vm_destroy_pagetable(pgtbl_t root, bool free_leaf) {
     }
     vm_freewalk(root, 2, free_leaf);
     // 最后释放根页表本身
-    pmem_free((uint64)root, true);
+    pgtbl_free((uint64)root);
 }
 
 uint64 vm_walkaddr(pgtbl_t pgtbl, uint64 va)
@@ -316,7 +756,8 @@ uint64 vm_walkaddr(pgtbl_t pgtbl, uint64 va)
     if (va >= MAXVA) {
         return 0;
     }
-    pte_t *pte = vm_getpte(pgtbl, va, false);
+    int level = 0;
+    pte_t *pte = vm_walk(pgtbl, va, false, 0, &level);
     if (pte == NULL) {
         return 0;
     }
@@ -326,7 +767,29 @@ uint64 vm_walkaddr(pgtbl_t pgtbl, uint64 va)
     if ((*pte & PTE_U) == 0) {
         return 0;
     }
-    return PTE_TO_PA(*pte);
+    // 大页叶子: 加上 va 所在 4KiB 页在大页内的偏移
+    return PTE_TO_PA(*pte) + (PG_ROUND_DOWN(va) & (VM_LEVEL_SIZE(level) - 1));
+}
+
+// uvm_fault_in: copyin/copyout 代替当前进程访问用户地址时, 按需处理缺页
+// 只处理当前进程自己的页表 (exec 构造中的新页表不走缺页路径)
+// 返回处理后的物理地址, 失败返回 0
+static uint64 uvm_fault_in(pgtbl_t pgtbl, uint64 va0, int type)
+{
+    struct proc *p = myproc();
+    if (p == NULL || p->pagetable != pgtbl) {
+        return 0;
+    }
+    // 缺页处理中分配内存可能触发换出, 这一页也可能因此再次失效, 直到满足访问要求为止
+    for (;;) {
+        pte_t *pte = vm_getpte(pgtbl, va0, false);
+        if (pte && (*pte & PTE_V) && (type != VM_FAULT_WRITE || (*pte & PTE_W))) {
+            return vm_walkaddr(pgtbl, va0);
+        }
+        if (vm_fault(p, va0, type) < 0) {
+            return 0;
+        }
+    }
 }
 
 int copyout(pgtbl_t pgtbl, uint64 dstva, const void *src, uint64 len)
@@ -334,7 +797,18 @@ int copyout(pgtbl_t pgtbl, uint64 dstva, const void *src, uint64 len)
     const uint8 *s = (const uint8*)src;
     while (len > 0) {
         uint64 va0 = PG_ROUND_DOWN(dstva);
-        uint64 pa0 = vm_walkaddr(pgtbl, va0);
+        if (va0 >= MAXVA) {
+            return -1;
+        }
+        // 内核代替用户写入 COW 页面、尚未分配的 lazy 页面或共享映射中的只读干净页时,
+        // 同样需要先处理缺页
+        pte_t *pte = vm_getpte(pgtbl, va0, false);
+        uint64 pa0;
+        if (pte == NULL || (*pte & (PTE_V | PTE_W)) != (PTE_V | PTE_W)) {
+            pa0 = uvm_fault_in(pgtbl, va0, VM_FAULT_WRITE);
+        } else {
+            pa0 = vm_walkaddr(pgtbl, va0);
+        }
         if (pa0 == 0) {
             return -1;
         }
@@ -357,6 +831,9 @@ int copyin(pgtbl_t pgtbl, void *dst, uint64 srcva, uint64 len)
     while (len > 0) {
         uint64 va0 = PG_ROUND_DOWN(srcva);
         uint64 pa0 = vm_walkaddr(pgtbl, va0);
+        if (pa0 == 0) {
+            pa0 = uvm_fault_in(pgtbl, va0, VM_FAULT_READ);
+        }
         if (pa0 == 0) {
             return -1;
         }
@@ -379,6 +856,9 @@ int copyinstr(pgtbl_t pgtbl, char *dst, uint64 srcva, uint64 max)
     while (copied < max) {
         uint64 va0 = PG_ROUND_DOWN(srcva);
         uint64 pa0 = vm_walkaddr(pgtbl, va0);
+        if (pa0 == 0) {
+            pa0 = uvm_fault_in(pgtbl, va0, VM_FAULT_READ);
+        }
         if (pa0 == 0) {
             return -1;
         }
@@ -406,12 +886,7 @@ int copyinstr(pgtbl_t pgtbl, char *dst, uint64 srcva, uint64 max)
 
 pagetable_t uvmcreate(void)
 {
-    pagetable_t pagetable = (pagetable_t)pmem_alloc(true);
-    if (pagetable == NULL) {
-        return NULL;
-    }
-    memset(pagetable, 0, PGSIZE);
-    return pagetable;
+    return (pagetable_t)pgtbl_alloc();
 }
 
 uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
@@ -421,38 +896,96 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     }
     uint64 a = PG_ROUND_UP(oldsz);
     for (; a < newsz; a += PGSIZE) {
-        void *mem = pmem_alloc(false);
+        void *mem = pmem_alloc_zeroed(false);
         if (mem == NULL) {
             uvmdealloc(pagetable, a, oldsz);
             return 0;
         }
-        memset(mem, 0, PGSIZE);
         vm_mappages(pagetable, a, (uint64)mem, PGSIZE, PTE_R | PTE_W | PTE_X | PTE_U);
     }
     return newsz;
 }
 
+// 攒够一批再交给 pmem_free_pages, 全局锁每 UVM_FREE_BATCH 页只获取一次
+struct free_batch {
+    uint64 pa[UVM_FREE_BATCH];
+    int n;
+};
+
+static int dealloc_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct free_batch *b = arg;
+    if (level == 1) {
+        // 整个被解除的用户大页 (只覆盖一部分的已由 VM_RANGE_SPLIT 拆开)
+        pmem_free_order(PTE_TO_PA(*pte), PMEM_MAX_ORDER, false);
+        __sync_fetch_and_sub(&thp_stat.mapped, 1);
+        *pte = 0;
+        return 0;
+    }
+    if (level != 0) {
+        panic("uvmdealloc: user gigapage");
+    }
+    if (PTE_IS_SWAP(*pte)) {
+        swap_free(*pte);
+        *pte = 0;
+        return 0;
+    }
+    if (*pte & PTE_IMG) {
+        // 程序映像页由所有进程共享, 不归 pmem 管理
+        *pte = 0;
+        return 0;
+    }
+    b->pa[b->n++] = PTE_TO_PA(*pte);
+    *pte = 0;
+    if (b->n == UVM_FREE_BATCH) {
+        pmem_free_pages(false, b->n, b->pa);
+        b->n = 0;
+    }
+    return 0;
+}
+
+// uvmdealloc: 把用户地址空间从 oldsz 缩小到 newsz, 只访问实际映射了的页, 变空的页表页一并回收
+// newsz 切开一个大页而分配不到页表页时什么也不做, 返回 oldsz
 uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
     if (newsz >= oldsz) {
         return oldsz;
     }
-    uint64 a = PG_ROUND_UP(newsz);
-    for (; a < oldsz; a += PGSIZE) {
-        pte_t *pte = vm_getpte(pagetable, a, false);
-        if (pte == NULL) {
-            continue;
-        }
-        if ((*pte & PTE_V) == 0) {
-            continue;
-        }
-        uint64 pa = PTE_TO_PA(*pte);
-        pmem_free(pa, false);
-        *pte = 0;
+    struct free_batch b;
+    b.n = 0;
+    if (vm_range_walk(pagetable, PG_ROUND_UP(newsz), PG_ROUND_UP(oldsz),
+                      VM_RANGE_SWAP | VM_RANGE_SPLIT | VM_RANGE_FREE, dealloc_leaf, &b) < 0) {
+        return oldsz;
     }
+    pmem_free_pages(false, b.n, b.pa);
+    // 被解除的映射可能还留在 TLB 中
+    vm_tlb_sync(pagetable);
     return newsz;
 }
 
+static int discard_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    // 直接映射程序映像的页面重新访问时内容也不会变, 保留映射即可
+    if (!PTE_IS_SWAP(*pte) && (*pte & PTE_IMG)) {
+        return 0;
+    }
+    return dealloc_leaf(pte, va, level, arg);
+}
+
+// uvm_discard: 解除 [va, end) 中的映射并释放页面 (madvise DONTNEED), 之后访问时重新按需分配
+// 拆大页时分配不到页表页返回 -1, 此时没有丢弃任何页面
+int uvm_discard(pagetable_t pagetable, uint64 va, uint64 end)
+{
+    struct free_batch b;
+    b.n = 0;
+    if (vm_range_walk(pagetable, va, end, VM_RANGE_SWAP | VM_RANGE_SPLIT | VM_RANGE_FREE, discard_leaf, &b) < 0) {
+        return -1;
+    }
+    pmem_free_pages(false, b.n, b.pa);
+    vm_tlb_sync(pagetable);
+    return 0;
+}
+
 void uvmfree(pagetable_t pagetable, uint64 sz)
 {
     if (sz > 0) {
@@ -461,26 +994,411 @@ void uvmfree(pagetable_t pagetable, uint64 sz)
     vm_destroy_pagetable(pagetable, false);
 }
 
-int uvmcopy(pagetable_t old, pagetable_t new_pt, uint64 sz)
+// uvm_strip: 释放 [0, sz) 的用户页和除 keep_va 所在子树以外的所有页表页,
+// 留下根页表和 keep_va (蹦床/trapframe) 那条页表链, 供下一个进程直接复用
+void uvm_strip(pagetable_t pagetable, uint64 sz, uint64 keep_va)
 {
-    for (uint64 a = 0; a < sz; a += PGSIZE) {
-        pte_t *pte = vm_getpte(old, a, false);
-        if (pte == NULL || (*pte & PTE_V) == 0) {
+    if (sz > 0) {
+        uvmdealloc(pagetable, sz, 0);
+    }
+    int keep = VA_TO_VPN(keep_va, 2);
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        if (i == keep || !(pte & PTE_V)) {
             continue;
         }
-        uint64 pa = PTE_TO_PA(*pte);
-        uint64 flags = PTE_FLAGS(*pte);
-        void *mem = pmem_alloc(false);
+        if (!PTE_CHECK(pte)) {
+            panic("uvm_strip: leaf in root");
+        }
+        vm_freewalk((pgtbl_t)PTE_TO_PA(pte), 1, false);
+        pgtbl_free(PTE_TO_PA(pte));
+        vm_pte_set(&pagetable[i], 0);
+    }
+}
+
+struct copy_args {
+    pagetable_t new_pt;
+    bool shared;        // 共享映射: 父子进程直接共用可写页, 不做写时复制
+    uint64 base;        // tbl 覆盖的 2MiB 区间起始
+    pgtbl_t tbl;        // 子进程中当前使用的最低级页表, 连续的叶子不必每次从根查找
+};
+
+static int copy_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct copy_args *c = arg;
+    if (level == 1) {
+        // 大页没有整体的写时复制: 先拆回 4KiB 页, 之后只复制真正被写的那几页
+        return VM_RANGE_DESCEND;
+    }
+    if (level != 0) {
+        return -1;
+    }
+    uint64 base = va & ~(VM_LEVEL_SIZE(1) - 1);
+    if (c->tbl == NULL || c->base != base) {
+        pte_t *npte = vm_getpte(c->new_pt, va, true);
+        if (npte == NULL) {
+            return -1;
+        }
+        c->tbl = npte - VA_TO_VPN(va, 0);
+        c->base = base;
+    }
+    if (PTE_IS_SWAP(*pte)) {
+        // 已换出的页面: 子进程共用同一个交换槽, 各自换入时得到私有的副本
+        swap_dup(*pte);
+    } else {
+        if (!c->shared && (*pte & PTE_W)) {
+            *pte = (*pte & ~PTE_W) | PTE_COW;
+        }
+        if (!(*pte & PTE_IMG)) {
+            pmem_ref_inc(PTE_TO_PA(*pte));
+        }
+    }
+    vm_pte_set(&c->tbl[VA_TO_VPN(va, 0)], *pte);
+    __sync_fetch_and_add(&cow_stat.shared, 1);
+    return 0;
+}
+
+// uvmcopy: fork 时复制用户地址空间 (写时复制)
+// 不复制页面内容, 父子进程共享同一物理页并增加其引用计数;
+// 可写页在双方 PTE 中都去掉 PTE_W 并打上 PTE_COW, 第一次写入时由 uvm_cow_fault 复制
+int uvmcopy(pagetable_t old, pagetable_t new_pt, uint64 sz)
+{
+    if (uvmcopy_range(old, new_pt, 0, PG_ROUND_UP(sz), false) < 0) {
+        // 已经复制过去的页面会在这里减少引用计数
+        uvmdealloc(new_pt, PG_ROUND_UP(sz), 0);
+        return -1;
+    }
+    return 0;
+}
+
+// uvmcopy_range: 把 [va, end) 中已映射的页面共享给 new_pt
+// shared 为假时按写时复制处理; 失败时已复制的部分由调用者负责解除
+int uvmcopy_range(pagetable_t old, pagetable_t new_pt, uint64 va, uint64 end, bool shared)
+{
+    struct copy_args c = { new_pt, shared, 0, NULL };
+    int r = vm_range_walk(old, va, end, VM_RANGE_SWAP, copy_leaf, &c);
+    // 父进程的 PTE 去掉了写权限, 刷新它的旧 TLB 项
+    vm_tlb_sync(old);
+    return r < 0 ? -1 : 0;
+}
+
+// uvm_cow_fault: 处理对 COW 页面的写入
+// 页面只剩一个引用时直接恢复写权限, 否则复制一份私有副本并释放对共享页的引用
+// 返回 0 表示已处理, -1 表示不是 COW 页面或内存不足
+int uvm_cow_fault(pagetable_t pagetable, uint64 va)
+{
+    if (va >= MAXVA) {
+        return -1;
+    }
+    va = PG_ROUND_DOWN(va);
+    pte_t *pte = vm_getpte(pagetable, va, false);
+    if (pte == NULL || (*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW)) {
+        return -1;
+    }
+    __sync_fetch_and_add(&cow_stat.faults, 1);
+
+    pte_t old = *pte;
+    uint64 pa = PTE_TO_PA(old);
+    uint64 flags = (PTE_FLAGS(old) & ~(PTE_COW | PTE_IMG)) | PTE_W;
+    if (!(old & PTE_IMG) && pmem_ref_count(pa) == 1) {
+        // 其他共享者都已经复制或退出, 这一页归当前进程独占
+        *pte = PA_TO_PTE(pa) | flags;
+        __sync_fetch_and_add(&cow_stat.reuses, 1);
+    } else {
+        // 仍被共享, 或者是直接映射程序映像的可写数据页: 复制一份私有页
+        // 共享零页不必复制, 直接分配一个清零页
+        bool zero = (pa == zero_page);
+        void *mem = uvm_alloc_page(zero);
         if (mem == NULL) {
-            uvmdealloc(new_pt, a, 0);
             return -1;
         }
-        memcpy(mem, (void*)pa, PGSIZE);
-        vm_mappages(new_pt, a, (uint64)mem, PGSIZE, flags);
+        if (*pte != old) {
+            // 分配时为了回收内存睡眠过, 这一页可能已被换出或不再共享, 交给调用者重新访问
+            pmem_free((uint64)mem, false);
+            return 0;
+        }
+        if (!zero) {
+            memcpy(mem, (void*)pa, PGSIZE);
+        }
+        *pte = PA_TO_PTE(mem) | flags;
+        if (!(old & PTE_IMG)) {
+            pmem_free(pa, false);
+        }
+        __sync_fetch_and_add(zero ? &zero_stat.breaks : &cow_stat.copies, 1);
     }
+    vm_tlb_sync(pagetable);
     return 0;
 }
 
+// uvm_is_zero: PTE 是否映射着共享零页
+static bool uvm_is_zero(pte_t pte)
+{
+    return (pte & PTE_V) && PTE_TO_PA(pte) == zero_page;
+}
+
+// uvm_map_zero: 把 va 映射到共享零页, perm 中不能有 PTE_W (可写的区域另外带上 PTE_COW)
+int uvm_map_zero(pagetable_t pagetable, uint64 va, int perm)
+{
+    pte_t *pte = vm_getpte(pagetable, va, true);
+    if (pte == NULL) {
+        return -1;
+    }
+    pmem_ref_inc(zero_page);
+    vm_pte_set(pte, PA_TO_PTE(zero_page) | perm | PTE_V);
+    __sync_fetch_and_add(&zero_stat.faults, 1);
+    return 0;
+}
+
+// uvm_zero_page: 共享零页的物理地址, 调用者自己维护引用计数
+uint64 uvm_zero_page(void)
+{
+    return zero_page;
+}
+
+// uvm_zero_mappings: 当前指向共享零页的映射数
+uint64 uvm_zero_mappings(void)
+{
+    return zero_page ? pmem_ref_count(zero_page) - 1 : 0;
+}
+
+// uvm_huge_fault: 尝试用一个 2MiB 大页叶子满足 va 处的按需分配
+// 条件: va 所在的 2MiB 对齐区间整个落在 [0, p->sz) 中, 且区间内还没有任何映射
+// (之前整体释放过后留下的空页表, 以及只读过的零页映射也算); 分不到连续的 2MiB 时返回 -1,
+// 由调用者退回 4KiB 页
+static int uvm_huge_fault(struct proc *p, uint64 va)
+{
+#ifdef VM_NO_THP
+    return -1;
+#else
+    uint64 size = VM_LEVEL_SIZE(1);
+    uint64 base = va & ~(size - 1);
+    if (base + size > p->sz) {
+        return -1;
+    }
+    int level;
+    pte_t *pte = vm_walk(p->pagetable, base, false, 1, &level);
+    if (pte != NULL && (level != 1 || (*pte & PTE_V))) {
+        if (level != 1 || !PTE_CHECK(*pte)) {
+            return -1;
+        }
+        pgtbl_t t = (pgtbl_t)PTE_TO_PA(*pte);
+        for (int i = 0; i < 512; i++) {
+            if (t[i] != 0 && !uvm_is_zero(t[i])) {
+                return -1;
+            }
+        }
+    }
+    void *mem = pmem_alloc_order(PMEM_MAX_ORDER, false);
+    if (mem == NULL) {
+        __sync_fetch_and_add(&thp_stat.fallbacks, 1);
+        return -1;
+    }
+    memset(mem, 0, size);
+    // 清零期间可能被抢占, 重新查找一次; 页表可能是刚才分配的
+    pte = vm_walk(p->pagetable, base, true, 1, &level);
+    if (pte == NULL || level != 1) {
+        pmem_free_order((uint64)mem, PMEM_MAX_ORDER, false);
+        return -1;
+    }
+    if (*pte & PTE_V) {
+        // 只有空的 (或只有零页映射的) 最低级页表才会走到这里, 换成大页叶子后释放它
+        pgtbl_t t = (pgtbl_t)PTE_TO_PA(*pte);
+        for (int i = 0; i < 512; i++) {
+            if (uvm_is_zero(t[i])) {
+                pmem_free(zero_page, false);
+            }
+        }
+        pgtbl_free((uint64)t);
+    }
+    vm_pte_set(pte, PA_TO_PTE(mem) | PTE_R | PTE_W | PTE_X | PTE_U | PTE_V);
+    // 被替换的页表和零页映射可能还在 TLB 中
+    vm_tlb_sync(p->pagetable);
+    __sync_fetch_and_add(&thp_stat.mapped, 1);
+    __sync_fetch_and_add(&thp_stat.faults, 1);
+    p->lazy_faults += size / PGSIZE;
+    p->min_flt++;
+    return 0;
+#endif
+}
+
+// vm_fault: 用户缺页的统一入口 (usertrap 以及 copyin/copyout)
+// - 写 COW 页面: 交给 uvm_cow_fault 复制 (写共享零页时先尝试整体换成大页)
+// - mmap 区域中的页面: 交给 mmap_fault 按 VMA 的属性处理
+// - [0, p->sz) 内尚未映射的页面: sbrk/用户栈是按需分配的, 读访问映射共享零页,
+//   其他访问才真正分配一个清零页
+// 返回 0 表示已处理, -1 表示非法访问 (调用者应当杀死进程或返回错误)
+int vm_fault(struct proc *p, uint64 va, int type)
+{
+    if (va >= MAXVA) {
+        return -1;
+    }
+    struct vma *v = NULL;
+    if (va >= p->sz && (v = mmap_find(p, va)) == NULL) {
+        return -1;
+    }
+    va = PG_ROUND_DOWN(va);
+    pte_t *pte = vm_getpte(p->pagetable, va, false);
+    if (pte && PTE_IS_SWAP(*pte)) {
+        int r = swap_in(p, va);
+        if (r == 0) {
+            p->maj_flt++;
+        }
+        return r;
+    }
+    if (pte && (*pte & PTE_V)) {
+        if (type == VM_FAULT_WRITE && (*pte & PTE_COW)) {
+            if (v == NULL && uvm_is_zero(*pte) && uvm_huge_fault(p, va) == 0) {
+                return 0;
+            }
+            int r = uvm_cow_fault(p->pagetable, va);
+            if (r == 0) {
+                p->min_flt++;
+            }
+            return r;
+        }
+        if (v) {
+            return mmap_fault(p, v, va, type);
+        }
+        // 页面存在但权限不符
+        return -1;
+    }
+    if (v) {
+        return mmap_fault(p, v, va, type);
+    }
+    if (type == VM_FAULT_READ) {
+        // 读取从未写过的页面: 映射共享零页, 不占用新的物理页
+        if (uvm_map_zero(p->pagetable, va, PTE_R | PTE_X | PTE_U | PTE_COW) < 0) {
+            return -1;
+        }
+        p->min_flt++;
+        return 0;
+    }
+    if (uvm_huge_fault(p, va) == 0) {
+        return 0;
+    }
+
+    void *mem = uvm_alloc_page(true);
+    if (mem == NULL) {
+        return -1;
+    }
+    pte = vm_getpte(p->pagetable, va, true);
+    if (pte == NULL) {
+        pmem_free((uint64)mem, false);
+        return -1;
+    }
+    vm_pte_set(pte, PA_TO_PTE(mem) | PTE_R | PTE_W | PTE_X | PTE_U | PTE_V);
+    p->lazy_faults++;
+    p->min_flt++;
+    return 0;
+}
+
+// uvm_alloc_page: 为用户分配一个物理页, 内存不足时先换出一批页面再重试
+// 在没有进程上下文 (启动阶段) 时不回收, 因为换出需要睡眠等待磁盘
+void* uvm_alloc_page(bool zero)
+{
+    for (int tries = 0;; tries++) {
+        void *mem = zero ? pmem_alloc_zeroed(false) : pmem_alloc(false);
+        if (mem != NULL || tries >= 2 || myproc() == NULL) {
+            return mem;
+        }
+        if (swap_reclaim(SWAP_RECLAIM_BATCH) == 0) {
+            return NULL;
+        }
+    }
+}
+
+static int count_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    uint64 *n = arg;
+    if (uvm_is_zero(*pte)) {
+        return 0;
+    }
+    n[(*pte & PTE_IMG) ? 1 : 0] += VM_LEVEL_SIZE(level) / PGSIZE;
+    return 0;
+}
+
+// uvm_resident: 统计 [0, sz) 中进程私有的物理页数;
+// shared 非空时另外返回直接映射程序映像 (所有进程共享) 的页数
+uint64 uvm_resident(pagetable_t pagetable, uint64 sz, uint64 *shared)
+{
+    uint64 n[2] = { 0, 0 };
+    vm_range_walk(pagetable, 0, PG_ROUND_UP(sz), 0, count_leaf, n);
+    if (shared) {
+        *shared = n[1];
+    }
+    return n[0];
+}
+
+static int usage_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    uvm_usage_t *u = arg;
+    if (PTE_IS_SWAP(*pte)) {
+        u->swapped++;
+        return 0;
+    }
+    // 共享零页不占用进程自己的物理页, 只通过 memstat 的 zero_maps 报告
+    if (!(*pte & PTE_U) || uvm_is_zero(*pte)) {
+        return 0;
+    }
+    uint64 n = VM_LEVEL_SIZE(level) / PGSIZE;
+    u->resident += n;
+    if ((*pte & PTE_IMG) || pmem_ref_count(PTE_TO_PA(*pte)) > 1) {
+        u->shared += n;
+    }
+    return 0;
+}
+
+static uint64 count_tables(pgtbl_t pgtbl, int level)
+{
+    uint64 n = 1;
+    if (level == 0) {
+        return n;
+    }
+    for (int i = 0; i < 512; i++) {
+        if ((pgtbl[i] & PTE_V) && PTE_CHECK(pgtbl[i])) {
+            n += count_tables((pgtbl_t)PTE_TO_PA(pgtbl[i]), level - 1);
+        }
+    }
+    return n;
+}
+
+// uvm_usage: 统计一个用户地址空间的内存占用 (堆/栈, mmap 区域都包括在内, 蹦床和 trapframe 不计)
+void uvm_usage(pagetable_t pagetable, uvm_usage_t *u)
+{
+    memset(u, 0, sizeof(*u));
+    vm_range_walk(pagetable, 0, TRAPFRAME, VM_RANGE_SWAP, usage_leaf, u);
+    u->pgtbl = count_tables(pagetable, 2);
+}
+
+uint64 vm_pgtbl_pages(void)
+{
+    return pgtbl_pages;
+}
+
+void uvm_print_cow_stats(void)
+{
+    printf("\n=== COW fork ===\n");
+    printf(" shared=%lu faults=%lu copies=%lu reuses=%lu\n",
+           cow_stat.shared, cow_stat.faults, cow_stat.copies, cow_stat.reuses);
+    printf("================\n");
+}
+
+void uvm_print_zero_stats(void)
+{
+    printf("\n=== shared zero page ===\n");
+    printf(" mappings=%lu faults=%lu breaks=%lu\n",
+           uvm_zero_mappings(), zero_stat.faults, zero_stat.breaks);
+    printf("========================\n");
+}
+
+void uvm_print_thp_stats(void)
+{
+    printf("\n=== user 2MiB pages ===\n");
+    printf(" mapped=%lu faults=%lu demotes=%lu fallbacks=%lu\n",
+           thp_stat.mapped, thp_stat.faults, thp_stat.demotes, thp_stat.fallbacks);
+    printf("=======================\n");
+}
+
 void uvmclear(pagetable_t pagetable, uint64 va)
 {
     pte_t *pte = vm_getpte(pagetable, va, false);
@@ -0,0 +1,91 @@
+#include "mem/wss.h"
+#include "mem/pmem.h"
+#include "mem/vmem.h"
+#include "lib/string.h"
+#include "memlayout.h"
+#include "proc/proc.h"
+
+// 全局采样代数, 只在 CPU 0 的时钟中断中递增; 从 1 开始, 进程的 ws_epoch 为 0 表示还没采样过
+static volatile uint64 ws_epoch = 1;
+
+// ws_tick: 时钟中断 (CPU 0) 调用, 每 WS_SAMPLE_TICKS 个 tick 开始一个新的采样周期
+void ws_tick(void)
+{
+    static int ticks;
+    if (++ticks >= WS_SAMPLE_TICKS) {
+        ticks = 0;
+        ws_epoch++;
+    }
+}
+
+struct ws_scan {
+    uint64 heap_end;      // [0, heap_end) 是匿名的堆和栈, PTE_D 可以一并清除
+    uint64 elapsed;       // 距离上次采样经过的周期数
+    bool cleared;         // 清除过 PTE_A/PTE_D, 需要刷新 TLB 才能重新记录
+    struct ws_stat st;
+};
+
+static int ws_leaf(pte_t *pte, uint64 va, int level, void *arg)
+{
+    struct ws_scan *w = arg;
+    if ((*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U)) {
+        return 0;
+    }
+    uint32 n = VM_LEVEL_SIZE(level) / PGSIZE;
+    bool accessed = (*pte & PTE_A) != 0;
+    if (accessed) {
+        w->st.accessed += n;
+        if (*pte & PTE_D) {
+            w->st.dirty += n;
+        }
+        *pte &= ~(va < w->heap_end ? (PTE_A | PTE_D) : PTE_A);
+        w->cleared = true;
+    }
+
+    uint64 pa = PTE_TO_PA(*pte);
+    if ((*pte & PTE_IMG) || pmem_ref_count(pa) != 1) {
+        // 程序映像页, 零页和 COW/共享内存页被多个进程映射, 年龄不归属任何一个进程
+        if (accessed) {
+            w->st.wss += n;
+        }
+        return 0;
+    }
+    uint64 age = accessed ? 0 : pmem_age(pa) + w->elapsed;
+    if (age > 255) {
+        age = 255;
+    }
+    pmem_set_age(pa, (uint8)age);
+    if (age == 0) {
+        w->st.hot += n;
+    } else if (age < WS_WINDOW) {
+        w->st.warm += n;
+    } else {
+        w->st.cold += n;
+    }
+    if (age < WS_WINDOW) {
+        w->st.wss += n;
+    }
+    return 0;
+}
+
+// ws_sample: 进程返回用户态之前调用, 进入了新的采样周期时采样一次自己的页表
+// 此时进程不在修改自己的页表, 换出只会动睡眠中的进程, 所以不需要加锁
+void ws_sample(struct proc *p)
+{
+    uint64 epoch = ws_epoch;
+    if (p->ws_epoch == epoch || p->pagetable == NULL) {
+        return;
+    }
+    struct ws_scan w;
+    memset(&w, 0, sizeof(w));
+    w.heap_end = PG_ROUND_UP(p->sz);
+    w.elapsed = p->ws_epoch ? epoch - p->ws_epoch : 1;
+    vm_range_walk(p->pagetable, 0, TRAPFRAME, 0, ws_leaf, &w);
+    if (w.cleared) {
+        uvm_tlb_flush(p);
+    }
+    w.st.samples = p->ws.samples + 1;
+    w.st.wss_peak = p->ws.wss_peak > w.st.wss ? p->ws.wss_peak : w.st.wss;
+    p->ws = w.st;
+    p->ws_epoch = epoch;
+}
@@ -2,6 +2,7 @@
 #include "mem/vmem.h"
 #include "mem/pmem.h"
 #include "lib/string.h"
+#include "lib/print.h"
 #include "memlayout.h"
 #include "elf.h"
 
@@ -15,6 +16,12 @@ extern char _binary_elfdemo_elf_start[];
 extern char _binary_elfdemo_elf_end[];
 extern char _binary_msgdemo_elf_start[];
 extern char _binary_msgdemo_elf_end[];
+extern char _binary_bench_elf_start[];
+extern char _binary_bench_elf_end[];
+extern char _binary_shmdemo_elf_start[];
+extern char _binary_shmdemo_elf_end[];
+extern char _binary_ps_elf_start[];
+extern char _binary_ps_elf_end[];
 
 struct embedded_image {
     const char *path;
@@ -29,6 +36,9 @@ static const struct embedded_image builtin_images[] = {
     { "/nice", (const uint8*)_binary_nice_elf_start, (const uint8*)_binary_nice_elf_end, 0 },
     { "/elfdemo", (const uint8*)_binary_elfdemo_elf_start, (const uint8*)_binary_elfdemo_elf_end, 0 },
     { "/msgdemo", (const uint8*)_binary_msgdemo_elf_start, (const uint8*)_binary_msgdemo_elf_end, 0 },
+    { "/bench", (const uint8*)_binary_bench_elf_start, (const uint8*)_binary_bench_elf_end, 0 },
+    { "/shmdemo", (const uint8*)_binary_shmdemo_elf_start, (const uint8*)_binary_shmdemo_elf_end, 0 },
+    { "/ps", (const uint8*)_binary_ps_elf_start, (const uint8*)_binary_ps_elf_end, 0 },
 };
 
 static int path_equals(const char *a, const char *b)
@@ -54,37 +64,77 @@ static const struct embedded_image* find_image(const char *path)
     return NULL;
 }
 
-static int loadseg(pagetable_t pagetable, uint64 va, const uint8 *src, uint64 filesz)
+// exec 的统计信息
+static struct {
+    uint64 execs;
+    uint64 shared_pages;    // 直接映射程序映像的页数 (只读段, 以及尚未写入的可写段)
+    uint64 copied_pages;    // 分配新页并复制内容的页数
+} exec_stat;
+
+static int map_segment(pagetable_t pagetable, uint64 va, uint64 sz, int perm)
 {
-    for (uint64 i = 0; i < filesz; i += PGSIZE) {
-        uint64 pa = vm_walkaddr(pagetable, va + i);
-        if (pa == 0) {
+    uint64 a = PG_ROUND_DOWN(va);
+    uint64 last = PG_ROUND_UP(va + sz);
+    for (; a < last; a += PGSIZE) {
+        void *mem = uvm_alloc_page(true);
+        if (mem == NULL) {
             return -1;
         }
-        uint64 n = filesz - i;
-        if (n > PGSIZE) {
-            n = PGSIZE;
-        }
-        memmove((void*)pa, src + i, n);
+        vm_mappages(pagetable, a, (uint64)mem, PGSIZE, perm | PTE_U);
     }
     return 0;
 }
 
-static int map_segment(pagetable_t pagetable, uint64 va, uint64 sz, int perm)
+// map_image_segment: 把嵌入映像中的一个 LOAD 段映射到用户页表
+// 映像在内核中按页对齐存放, 段的文件偏移与虚拟地址页内偏移相同时, 不含 bss 的页面直接映射映像本身:
+// 只读段所有进程共享同一份, 可写段以写时复制方式映射, 第一次写入时才复制。
+// 其余页面 (含 bss 或无法对齐) 分配新页并复制内容。
+static int map_image_segment(pagetable_t pagetable, const struct embedded_image *img,
+                             const struct proghdr *ph, int perm)
 {
-    uint64 a = PG_ROUND_DOWN(va);
-    uint64 last = PG_ROUND_UP(va + sz);
-    for (; a < last; a += PGSIZE) {
-        void *mem = pmem_alloc(false);
+    uint64 start = (uint64)img->start;
+    uint64 img_end = PG_ROUND_UP((uint64)img->end);
+    uint64 file_end = ph->vaddr + ph->filesz;
+    uint64 mem_end = ph->vaddr + ph->memsz;
+    bool aligned = ((start + ph->off - ph->vaddr) % PGSIZE) == 0;
+
+    for (uint64 a = PG_ROUND_DOWN(ph->vaddr); a < mem_end; a += PGSIZE) {
+        // a 这一页在映像中的位置 (段首页可能从段之前开始)
+        uint64 src = start + ph->off - (ph->vaddr - a);
+        bool no_bss = (a + PGSIZE <= file_end) || (ph->memsz == ph->filesz);
+        if (aligned && a < file_end && no_bss && src >= start && src + PGSIZE <= img_end) {
+            int flags = perm | PTE_U | PTE_IMG;
+            if (flags & PTE_W) {
+                flags = (flags & ~PTE_W) | PTE_COW;
+            }
+            vm_mappages(pagetable, a, src, PGSIZE, flags);
+            exec_stat.shared_pages++;
+            continue;
+        }
+
+        void *mem = uvm_alloc_page(true);
         if (mem == NULL) {
             return -1;
         }
-        memset(mem, 0, PGSIZE);
+        uint64 lo = a > ph->vaddr ? a : ph->vaddr;
+        uint64 hi = a + PGSIZE < file_end ? a + PGSIZE : file_end;
+        if (lo < hi) {
+            memmove((char*)mem + (lo - a), img->start + ph->off + (lo - ph->vaddr), hi - lo);
+        }
         vm_mappages(pagetable, a, (uint64)mem, PGSIZE, perm | PTE_U);
+        exec_stat.copied_pages++;
     }
     return 0;
 }
 
+void exec_print_stats(void)
+{
+    printf("\n=== exec ===\n");
+    printf(" execs=%lu shared_pages=%lu copied_pages=%lu\n",
+           exec_stat.execs, exec_stat.shared_pages, exec_stat.copied_pages);
+    printf("============\n");
+}
+
 int exec_process(struct proc *p, const char *path, const char *const argv[])
 {
     if (!p || !path)
@@ -135,25 +185,25 @@ int exec_process(struct proc *p, const char *path, const char *const argv[])
         if (ph->flags & ELF_PROG_FLAG_READ) perm |= PTE_R;
         if (ph->flags & ELF_PROG_FLAG_WRITE) perm |= PTE_W;
         if (ph->flags & ELF_PROG_FLAG_EXEC) perm |= PTE_X;
-        if (map_segment(pagetable, ph->vaddr, ph->memsz, perm) < 0) {
-            goto bad;
+        // 先记下本段的范围, 映射到一半失败时也能完整回收
+        uint64 end = ph->vaddr + ph->memsz;
+        if (end > mapped_sz) {
+            mapped_sz = end;
         }
-        if (loadseg(pagetable, ph->vaddr, img->start + ph->off, ph->filesz) < 0) {
+        if (map_image_segment(pagetable, img, ph, perm) < 0) {
             goto bad;
         }
-        uint64 end = ph->vaddr + ph->memsz;
         if (end > sz) {
             sz = end;
         }
-        if (sz > mapped_sz) {
-            mapped_sz = sz;
-        }
     }
 
+    // 用户栈占 USTACK_PAGES 页, 只有存放参数的栈顶一页立即分配,
+    // 其余页面在栈向下增长、第一次被访问时由 vm_fault 按需分配
     sz = PG_ROUND_UP(sz);
     mapped_sz = sz;
-    uint64 stack_top = sz + PGSIZE;
-    if (map_segment(pagetable, sz, PGSIZE, PTE_R | PTE_W) < 0) {
+    uint64 stack_top = sz + USTACK_PAGES * PGSIZE;
+    if (map_segment(pagetable, stack_top - PGSIZE, PGSIZE, PTE_R | PTE_W) < 0) {
         goto bad;
     }
     mapped_sz = stack_top;
@@ -192,12 +242,22 @@ int exec_process(struct proc *p, const char *path, const char *const argv[])
         goto bad;
     }
 
+    // exec 不保留原来的 mmap 映射, 共享文件映射先写回
+    mmap_release(p, true);
     pagetable_t old = p->pagetable;
     uint64 oldsz = p->sz;
 
     memset(p->trapframe, 0, sizeof(*p->trapframe));
     p->pagetable = pagetable;
+    // 换了新页表: 分配新的 ASID, 旧 ASID 的 TLB 项随代数回收时一起清除
+    uvm_asid_reset(p);
     p->sz = stack_top;
+    p->heap_base = stack_top;
+    // 新的程序映像重新开始估计工作集
+    p->ws_epoch = 0;
+    memset(&p->ws, 0, sizeof(p->ws));
+    p->ksm_epoch = 0;
+    p->ksm_next = 0;
     p->trapframe->epc = elf.entry;
     p->trapframe->sp = sp;
     p->trapframe->a0 = argc;
@@ -211,8 +271,9 @@ int exec_process(struct proc *p, const char *path, const char *const argv[])
     safestrcpy(p->name, last, sizeof(p->name));
 
     if (old) {
-        proc_freepagetable(old, oldsz);
+        proc_recyclepagetable(p, old, oldsz);
     }
+    exec_stat.execs++;
     return argc;
 
 bad:
@@ -1,10 +1,13 @@
 #include "lib/string.h"
 #include "lib/print.h"
 #include "lib/lock.h"
+#include "lib/klog.h"
 #include "mem/pmem.h"
 #include "mem/vmem.h"
+#include "ipc/shm.h"
 #include "memlayout.h"
 #include "fs/fs.h"
+#include "fs/log.h"
 #include "proc/proc.h"
 #include "trap/trap.h"
 #include "riscv.h"
@@ -17,9 +20,29 @@ struct cpu cpus[NCPU];
 
 static int next_pid = 1;
 static int proc_initialized = 0;
-static spinlock_t proc_table_lock;
+static spinlock_t proc_table_lock;   // 也保护所有进程的 parent 和 orphan
+static struct proc *initproc;        // 孤儿进程的收养者, init 退出后为 NULL
 static spinlock_t pid_lock;
 
+// 进程外壳缓存: 回收进程时保留内核栈, trapframe 和只映射了蹦床/trapframe 的根页表,
+// 创建进程时直接取用, 稳定状态下 fork/exit/wait 不再为这些结构分配和清零页面
+// make PROC_NO_SHELL_CACHE=1 关闭缓存, 用于对比测试
+#define PROC_SHELL_CACHE 8
+
+struct proc_shell {
+    uint64 kstack;
+    struct trapframe *trapframe;
+    pagetable_t pagetable;    // 可能为 NULL (内核线程不需要用户页表)
+};
+
+static struct {
+    spinlock_t lock;
+    int n;
+    struct proc_shell shells[PROC_SHELL_CACHE];
+    uint64 hits;     // 直接取到缓存外壳的次数
+    uint64 misses;   // 需要现场分配的次数
+} shell_cache;
+
 static const int mlfq_quantum[MLFQ_LEVELS] = { 2, 4, 8 };
 static const int mlfq_aging_threshold = 16;
 
@@ -53,6 +76,8 @@ void proc_init(void)
     memset(cpus, 0, sizeof(cpus));
     spinlock_init(&proc_table_lock, "proc_table");
     spinlock_init(&pid_lock, "pid_lock");
+    spinlock_init(&shell_cache.lock, "proc_shell");
+    shell_cache.n = 0;
 
     for (int i = 0; i < NCPU; i++) {
         cpus[i].id = i;
@@ -69,6 +94,60 @@ void proc_init(void)
     proc_initialized = 1;
 }
 
+// shell_get: 取一个进程外壳, 缓存为空时现场分配内核栈和 trapframe (根页表留给 proc_pagetable)
+static int shell_get(struct proc_shell *s)
+{
+#ifndef PROC_NO_SHELL_CACHE
+    spinlock_acquire(&shell_cache.lock);
+    if (shell_cache.n > 0) {
+        *s = shell_cache.shells[--shell_cache.n];
+        shell_cache.hits++;
+        spinlock_release(&shell_cache.lock);
+        return 0;
+    }
+    shell_cache.misses++;
+    spinlock_release(&shell_cache.lock);
+#endif
+    s->pagetable = NULL;
+    s->kstack = (uint64)pmem_alloc(true);
+    if (!s->kstack) {
+        return -1;
+    }
+    s->trapframe = (struct trapframe*)pmem_alloc_zeroed(true);
+    if (!s->trapframe) {
+        pmem_free(s->kstack, true);
+        return -1;
+    }
+    return 0;
+}
+
+// shell_put: 归还进程外壳, 缓存已满时释放
+static void shell_put(struct proc_shell *s)
+{
+#ifndef PROC_NO_SHELL_CACHE
+    memset(s->trapframe, 0, sizeof(*s->trapframe));
+    spinlock_acquire(&shell_cache.lock);
+    if (shell_cache.n < PROC_SHELL_CACHE) {
+        shell_cache.shells[shell_cache.n++] = *s;
+        spinlock_release(&shell_cache.lock);
+        return;
+    }
+    spinlock_release(&shell_cache.lock);
+#endif
+    if (s->pagetable) {
+        proc_freepagetable(s->pagetable, 0);
+    }
+    pmem_free((uint64)s->trapframe, true);
+    pmem_free(s->kstack, true);
+}
+
+void proc_print_shell_stats(void)
+{
+    printf("\n=== PROC shell cache ===\n");
+    printf(" cached=%d hits=%lu misses=%lu\n", shell_cache.n, shell_cache.hits, shell_cache.misses);
+    printf("========================\n");
+}
+
 static struct proc* alloc_process(void (*entry)(void), const char *name)
 {
     struct proc *p = 0;
@@ -93,6 +172,7 @@ static struct proc* alloc_process(void (*entry)(void), const char *name)
 
     p->entry = entry;
     p->parent = myproc();
+    p->orphan = 0;
     p->exit_code = 0;
     p->killed = 0;
     p->chan = 0;
@@ -101,7 +181,20 @@ static struct proc* alloc_process(void (*entry)(void), const char *name)
     p->ticks_in_level = 0;
     p->wait_ticks = 0;
     p->sz = 0;
+    p->heap_base = 0;
+    p->lazy_faults = 0;
+    p->min_flt = 0;
+    p->maj_flt = 0;
+    p->ws_epoch = 0;
+    memset(&p->ws, 0, sizeof(p->ws));
+    p->ksm_epoch = 0;
+    p->ksm_next = 0;
+    p->vmas = 0;
     p->pagetable = 0;
+    p->spare_pagetable = 0;
+    p->asid = 0;
+    p->asid_gen = 0;
+    p->tlb_stale = 0;
     p->trapframe = 0;
     p->name[0] = '\0';
     for (int i = 0; i < NOFILE; i++) {
@@ -114,22 +207,8 @@ static struct proc* alloc_process(void (*entry)(void), const char *name)
         p->name[sizeof(p->name) - 1] = '\0';
     }
 
-    void *stack_page = pmem_alloc(true);
-    if (!stack_page) {
-        p->pid = 0;
-        p->parent = 0;
-        p->entry = 0;
-        p->state = PROC_UNUSED;
-        spinlock_release(&p->lock);
-        return 0;
-    }
-
-    p->kstack = (uint64)stack_page;
-
-    struct trapframe *tf_page = (struct trapframe*)pmem_alloc(true);
-    if (!tf_page) {
-        pmem_free(p->kstack, true);
-        p->kstack = 0;
+    struct proc_shell shell;
+    if (shell_get(&shell) < 0) {
         p->pid = 0;
         p->parent = 0;
         p->entry = 0;
@@ -137,8 +216,9 @@ static struct proc* alloc_process(void (*entry)(void), const char *name)
         spinlock_release(&p->lock);
         return 0;
     }
-    memset(tf_page, 0, PGSIZE);
-    p->trapframe = tf_page;
+    p->kstack = shell.kstack;
+    p->trapframe = shell.trapframe;
+    p->spare_pagetable = shell.pagetable;
 
     memset(&p->ctx, 0, sizeof(p->ctx));
     p->ctx.sp = p->kstack + PGSIZE;
@@ -171,6 +251,62 @@ void exit_process(int status)
     if (!p)
         panic("exit_process: no current process");
 
+    // 打开的文件和当前目录: iput 可能睡眠, 必须在持有任何自旋锁之前释放
+    for (int i = 0; i < NOFILE; i++) {
+        if (p->ofile[i]) {
+            fileclose(p->ofile[i]);
+            p->ofile[i] = 0;
+        }
+    }
+    if (p->cwd) {
+        begin_op();
+        iput(p->cwd);
+        end_op();
+        p->cwd = 0;
+    }
+
+    if (p->pagetable) {
+        uint64 shared = 0;
+        uint64 resident = uvm_resident(p->pagetable, p->sz, &shared);
+        klog(LOG_LEVEL_DEBUG, "[VM] pid=%d exit sz_pages=%llu resident=%llu shared_text=%llu lazy_faults=%llu minflt=%llu majflt=%llu",
+             p->pid, PG_ROUND_UP(p->sz) / PGSIZE, resident, shared, p->lazy_faults, p->min_flt, p->maj_flt);
+        // 共享文件映射的脏页要在这里写回: 回收进程时持有自旋锁, 不能再做磁盘 I/O
+        mmap_release(p, true);
+        // 自己创建却从未被映射的共享内存段没有别人会释放了
+        shm_exit(p);
+        // 用户地址空间现在就释放, 不必等父进程 wait; 先在锁内摘下页表,
+        // memstat 等并发的观察者不会看到释放了一半的页表
+        spinlock_acquire(&p->lock);
+        pagetable_t pagetable = p->pagetable;
+        uint64 sz = p->sz;
+        p->pagetable = 0;
+        p->sz = 0;
+        p->heap_base = 0;
+        spinlock_release(&p->lock);
+        proc_recyclepagetable(p, pagetable, sz);
+    }
+
+    // 从这里到切换回调度器都不能被时钟中断 yield, 否则僵尸会被重新标记为可运行
+    intr_off();
+    spinlock_acquire(&proc_table_lock);
+    if (p == initproc) {
+        initproc = 0;
+    }
+    // 子进程过继给 init, 之后由内核自动回收; 已经退出的直接回收
+    for (int i = 0; i < NPROC; i++) {
+        struct proc *q = &proc_table[i];
+        if (q == p || q->parent != p) {
+            continue;
+        }
+        spinlock_acquire(&q->lock);
+        q->parent = initproc;
+        q->orphan = 1;
+        if (q->state == PROC_ZOMBIE) {
+            free_process(q);
+        }
+        spinlock_release(&q->lock);
+    }
+
     spinlock_acquire(&p->lock);
     p->exit_code = status;
     p->state = PROC_ZOMBIE;
@@ -178,7 +314,9 @@ void exit_process(int status)
 
     if (p->parent)
         wakeup(p->parent);
+    spinlock_release(&proc_table_lock);
 
+    // 剩下的内核栈和 trapframe 由父进程的 wait 回收, 没有父进程等待时由调度器回收
     struct cpu *c = mycpu();
     swtch(&p->ctx, &c->ctx);
 
@@ -188,6 +326,19 @@ void exit_process(int status)
     }
 }
 
+// proc_reap: 调度器在僵尸进程切换出去之后调用; 孤儿和没有父进程的进程 (内核线程, init)
+// 不会有人 wait, 在这里回收它剩下的内核栈和 trapframe
+static void proc_reap(struct proc *p)
+{
+    spinlock_acquire(&proc_table_lock);
+    spinlock_acquire(&p->lock);
+    if (p->state == PROC_ZOMBIE && (p->parent == 0 || p->orphan)) {
+        free_process(p);
+    }
+    spinlock_release(&p->lock);
+    spinlock_release(&proc_table_lock);
+}
+
 int wait_process(int *status)
 {
     struct proc *cur = myproc();
@@ -201,7 +352,8 @@ int wait_process(int *status)
         for (int i = 0; i < NPROC; i++) {
             struct proc *p = &proc_table[i];
 
-            if (p->parent != cur)
+            // 过继来的孤儿由内核自动回收, wait 只等自己创建的子进程
+            if (p->parent != cur || p->orphan)
                 continue;
 
             have_child = 1;
@@ -311,6 +463,7 @@ void userinit(void)
     }
     p->cwd = iget(fs_device(), ROOTINO);
     p->state = PROC_RUNNABLE;
+    initproc = p;
 
     spinlock_release(&p->lock);
 }
@@ -329,6 +482,7 @@ int fork_process(void)
 
     np->parent = p;
     np->sz = p->sz;
+    np->heap_base = p->heap_base;
     np->priority = p->priority;
     np->queue_level = p->queue_level;
     np->ticks_in_level = 0;
@@ -341,7 +495,8 @@ int fork_process(void)
         return -1;
     }
 
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
+    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 || mmap_fork(p, np) < 0) {
+        mmap_release(np, false);
         proc_freepagetable(np->pagetable, np->sz);
         np->pagetable = 0;
         free_process(np);
@@ -421,6 +576,8 @@ void scheduler(void)
 
     schedule_pick:
         if (!selected) {
+            // 没有可运行的进程: 顺便为预清零页池补充页面
+            pmem_zero_refill();
             continue;
         }
 
@@ -434,6 +591,9 @@ void scheduler(void)
         swtch(&c->ctx, &selected->ctx);
 
         c->proc = 0;
+        if (selected->state == PROC_ZOMBIE) {
+            proc_reap(selected);
+        }
     }
 }
 
@@ -473,14 +633,21 @@ void wakeup(void *chan)
 
 pagetable_t proc_pagetable(struct proc *p)
 {
+    if (p->spare_pagetable) {
+        // 外壳自带的根页表已经映射好了蹦床和本进程的 trapframe
+        pagetable_t pagetable = p->spare_pagetable;
+        p->spare_pagetable = 0;
+        return pagetable;
+    }
     pagetable_t pagetable = uvmcreate();
     if (pagetable == NULL) {
         return NULL;
     }
 
     // Map trampoline
-    vm_mappages(pagetable, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
-    // Map trapframe
+    // 所有地址空间中的 trampoline 都相同, 标记为全局映射, 切换 ASID 时无需重新加载
+    vm_mappages(pagetable, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
+    // Map trapframe (每个进程不同, 不能是全局映射)
     vm_mappages(pagetable, TRAPFRAME, (uint64)p->trapframe, PGSIZE, PTE_R | PTE_W);
 
     return pagetable;
@@ -496,6 +663,23 @@ void proc_freepagetable(pagetable_t pagetable, uint64 sz)
     uvmfree(pagetable, sz);
 }
 
+// proc_recyclepagetable: 释放 p 的一个用户页表; 只要 p 还没有备用页表,
+// 就保留根页表和蹦床/trapframe 的映射留给下一次 proc_pagetable (exec, 或外壳被下一个进程复用)
+void proc_recyclepagetable(struct proc *p, pagetable_t pagetable, uint64 sz)
+{
+    if (pagetable == NULL) {
+        return;
+    }
+#ifndef PROC_NO_SHELL_CACHE
+    if (p->spare_pagetable == NULL) {
+        uvm_strip(pagetable, sz, TRAMPOLINE);
+        p->spare_pagetable = pagetable;
+        return;
+    }
+#endif
+    proc_freepagetable(pagetable, sz);
+}
+
 int priority_to_level(int priority)
 {
     if (priority <= PRIORITY_MIN)
@@ -581,39 +765,46 @@ int growproc(int n)
 
     uint64 sz = p->sz;
     if (n > 0) {
+        // 只扩大地址空间, 页面在第一次访问时由 vm_fault 分配并清零
         uint64 newsz = sz + (uint64)n;
-        uint64 res = uvmalloc(p->pagetable, sz, newsz);
-        if (res == 0) {
+        if (newsz < sz || newsz > mmap_floor(p)) {
             return -1;
         }
-        p->sz = res;
+        p->sz = newsz;
     } else if (n < 0) {
         uint64 decr = (uint64)(-n);
         uint64 target = (decr > sz) ? 0 : sz - decr;
-        uint64 res = uvmdealloc(p->pagetable, sz, target);
-        p->sz = res;
+        // 解除映射时会回收变空的页表页, 持有 p->lock 以免 memstat 同时遍历到它们
+        // target 切开一个大页而内存不足时, uvmdealloc 不做任何修改, 返回原来的大小
+        spinlock_acquire(&p->lock);
+        p->sz = uvmdealloc(p->pagetable, sz, target);
+        spinlock_release(&p->lock);
+        if (p->sz != target) {
+            return -1;
+        }
     }
     return 0;
 }
 
+// free_process: 回收进程表项; 正常退出的进程在 exit_process 中已经释放了地址空间和文件,
+// 这里只剩内核栈和 trapframe (fork 失败时其余资源也在这里释放)
 static void free_process(struct proc *p)
 {
     if (!p)
         return;
 
-    if (p->kstack) {
-        pmem_free(p->kstack, true);
-        p->kstack = 0;
+    if (p->pagetable) {
+        mmap_release(p, false);
+        proc_recyclepagetable(p, p->pagetable, p->sz);
+        p->pagetable = 0;
     }
 
-    if (p->trapframe) {
-        pmem_free((uint64)p->trapframe, true);
+    if (p->kstack) {
+        struct proc_shell shell = { p->kstack, p->trapframe, p->spare_pagetable };
+        shell_put(&shell);
+        p->kstack = 0;
         p->trapframe = 0;
-    }
-
-    if (p->pagetable) {
-        proc_freepagetable(p->pagetable, p->sz);
-        p->pagetable = 0;
+        p->spare_pagetable = 0;
     }
 
     for (int i = 0; i < NOFILE; i++) {
@@ -629,6 +820,7 @@ static void free_process(struct proc *p)
 
     p->pid = 0;
     p->parent = 0;
+    p->orphan = 0;
     p->exit_code = 0;
     p->killed = 0;
     p->chan = 0;
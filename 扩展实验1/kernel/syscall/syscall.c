@@ -36,6 +36,13 @@ extern int sys_klog(void);
 extern int sys_msgget(void);
 extern int sys_msgsend(void);
 extern int sys_msgrecv(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_memstat(void);
+extern int sys_madvise(void);
 
 static struct syscall_desc syscall_table[SYS_MAX] = {
     [SYS_fork]   = { sys_fork,   "fork",   0 },
@@ -63,6 +70,13 @@ static struct syscall_desc syscall_table[SYS_MAX] = {
     [SYS_unlink] = { sys_unlink, "unlink", 1 },
     [SYS_link]   = { sys_link,   "link",   2 },
     [SYS_dup]    = { sys_dup,    "dup",    1 },
+    [SYS_mmap]   = { sys_mmap,   "mmap",   6 },
+    [SYS_munmap] = { sys_munmap, "munmap", 2 },
+    [SYS_shmget] = { sys_shmget, "shmget", 2 },
+    [SYS_shmat]  = { sys_shmat,  "shmat",  1 },
+    [SYS_shmdt]  = { sys_shmdt,  "shmdt",  1 },
+    [SYS_memstat]= { sys_memstat,"memstat",2 },
+    [SYS_madvise]= { sys_madvise,"madvise",3 },
 };
 
 static uint64 argraw(struct proc *p, int n)
@@ -98,7 +112,8 @@ int argaddr(int n, uint64 *ip)
 {
     struct proc *p = myproc();
     uint64 addr = argraw(p, n);
-    if (p->sz && addr >= p->sz) {
+    // 堆之上只有 mmap 映射的区域才是合法的用户地址
+    if (p->sz && addr >= p->sz && !mmap_find(p, addr)) {
         return -1;
     }
     if (ip) {
@@ -454,3 +454,43 @@ int sys_pipe(void)
 
     return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off): addr 只作提示, 映射位置由内核选择
+int sys_mmap(void)
+{
+    int len, prot, flags, fd, off;
+    if (argint(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+        argint(4, &fd) < 0 || argint(5, &off) < 0)
+        return -1;
+    if (len <= 0 || off < 0)
+        return -1;
+    struct proc *p = myproc();
+    struct file *f = 0;
+    if (!(flags & MAP_ANONYMOUS)) {
+        if (fd < 0 || fd >= NOFILE || (f = p->ofile[fd]) == 0)
+            return -1;
+    }
+    return (int)mmap_map(p, (uint64)len, prot, flags, f, (uint64)off);
+}
+
+int sys_munmap(void)
+{
+    uint64 addr;
+    int len;
+    if (argaddr(0, &addr) < 0 || argint(1, &len) < 0)
+        return -1;
+    if (len <= 0)
+        return -1;
+    return mmap_unmap(myproc(), addr, (uint64)len);
+}
+
+int sys_madvise(void)
+{
+    uint64 addr;
+    int len, advice;
+    if (argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &advice) < 0)
+        return -1;
+    if (len <= 0)
+        return -1;
+    return mmap_madvise(myproc(), addr, (uint64)len, advice);
+}
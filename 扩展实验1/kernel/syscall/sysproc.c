@@ -2,6 +2,7 @@
 #include "proc/proc.h"
 #include "mem/vmem.h"
 #include "lib/klog.h"
+#include "mem/memstat.h"
 
 int sys_fork(void)
 {
@@ -114,3 +115,27 @@ int sys_sbrk(void)
     }
     return addr;
 }
+
+int sys_memstat(void)
+{
+    int slot;
+    uint64 uaddr;
+    if (argint(0, &slot) < 0 || argaddr(1, &uaddr) < 0) {
+        return -1;
+    }
+    struct proc *p = myproc();
+    if (slot == MEMSTAT_SYSTEM) {
+        struct memstat_sys st;
+        memstat_system(&st);
+        return copyout(p->pagetable, uaddr, (char*)&st, sizeof(st)) < 0 ? -1 : 0;
+    }
+    struct memstat_proc st;
+    int r = memstat_proc(slot, &st);
+    if (r <= 0) {
+        return r;
+    }
+    if (copyout(p->pagetable, uaddr, (char*)&st, sizeof(st)) < 0) {
+        return -1;
+    }
+    return r;
+}
@@ -0,0 +1,33 @@
+#include "syscall.h"
+#include "ipc/shm.h"
+#include "proc/proc.h"
+
+int sys_shmget(void)
+{
+    int key, size;
+    if (argint(0, &key) < 0 || argint(1, &size) < 0) {
+        return -1;
+    }
+    if (size <= 0) {
+        return -1;
+    }
+    return shm_get(key, (uint64)size);
+}
+
+int sys_shmat(void)
+{
+    int id;
+    if (argint(0, &id) < 0) {
+        return -1;
+    }
+    return (int)shm_attach(myproc(), id);
+}
+
+int sys_shmdt(void)
+{
+    uint64 addr;
+    if (argaddr(0, &addr) < 0) {
+        return -1;
+    }
+    return shm_detach(myproc(), addr);
+}
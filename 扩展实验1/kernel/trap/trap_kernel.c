@@ -7,6 +7,9 @@
 #include "proc/proc.h"
 #include "memlayout.h"
 #include "mem/vmem.h"
+#include "mem/wss.h"
+#include "mem/ksm.h"
+#include "mem/vmalloc.h"
 #include "syscall.h"
 #include "riscv.h"
 
@@ -133,6 +136,9 @@ void trap_inithart(void)
     // 为当前 hart 使能 UART 外设中断
     enable_interrupt(UART_IRQ);
     enable_interrupt(VIRTIO_IRQ);
+
+    // 允许用户态读取 cycle/time/instret (rdtime), 供用户态基准测试计时
+    w_scounteren(0x7);
 }
 
 // 保留原名字做一层兼容封装（其他文件还用的话也能编）
@@ -243,6 +249,8 @@ void timer_interrupt_handler()
     if(mycpuid() == 0) {
         timer_update();
     }
+    // vmalloc 清理过延迟释放的地址后, 每个 hart 在这里补上一次整体刷新
+    vmalloc_tlb_sync();
 
     struct proc *p = myproc();
     if (p && proc_tick()) {
@@ -252,6 +260,8 @@ void timer_interrupt_handler()
     proc_age();
     static int boost_counter = 0;
     if (mycpuid() == 0) {
+        ws_tick();
+        ksm_tick();
         boost_counter++;
         if (boost_counter >= 64) {
             boost_counter = 0;
@@ -341,6 +351,10 @@ static void usertrap(void)
         syscall();
     } else if (handle_interrupt(scause)) {
         // 设备中断已处理
+    } else if ((scause == 12 || scause == 13 || scause == 15) &&
+               vm_fault(p, r_stval(), scause == 12 ? VM_FAULT_EXEC :
+                        scause == 13 ? VM_FAULT_READ : VM_FAULT_WRITE) == 0) {
+        // 缺页已处理 (写 COW 页面 / 按需分配的 sbrk 与栈页面), 返回用户态重新执行该指令
     } else {
         uint64 stval = r_stval();
         printf("usertrap: unexpected scause=%p stval=%p pid=%d\n",
@@ -362,6 +376,11 @@ void usertrapret(void)
         panic("usertrapret: invalid process state");
     }
 
+    // 进入了新的采样周期时, 在回到用户态之前采样一次 PTE_A/PTE_D
+    ws_sample(p);
+    // 进入了新的扫描周期时, 扫描一批自己的页面, 合并内容相同的页
+    ksm_scan(p);
+
     intr_off();
 
     uint64 trampoline_uservec = TRAMPOLINE + ((uint64)uservec - (uint64)trampoline);
@@ -382,9 +401,12 @@ void usertrapret(void)
 
     w_sepc(tf->epc);
 
-    uint64 user_satp = MAKE_SATP(p->pagetable);
-    void (*enter_user)(uint64) = (void (*)(uint64))trampoline_userret;
-    enter_user(user_satp);
+    // 带 ASID 的 satp: 切换地址空间时不必整体刷新 TLB
+    int flush = 0;
+    uint64 user_satp = uvm_satp(p, &flush);
+    tf->tlb_flush = flush;
+    void (*enter_user)(uint64, uint64) = (void (*)(uint64, uint64))trampoline_userret;
+    enter_user(user_satp, flush);
 
     panic("usertrapret: unreachable");
 }
@@ -146,14 +146,18 @@ def initialize_filesystem(f, layout):
     write_bitmap(f, layout)
 
 
-def create_image(path: str, size_mb: int):
+def create_image(path: str, size_mb: int, swap_mb: int = 0):
     total_bytes = size_mb * 1024 * 1024
     if total_bytes % BSIZE != 0:
         total_bytes = ((total_bytes // BSIZE) + 1) * BSIZE
 
+    # 交换区紧跟在文件系统之后, 不属于文件系统 (superblock 的 size 不包含它),
+    # 内核根据磁盘容量与 superblock.size 之差得到交换区大小
+    swap_bytes = swap_mb * 1024 * 1024
+
     os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
     with open(path, "wb") as f:
-        f.truncate(total_bytes)
+        f.truncate(total_bytes + swap_bytes)
 
     blocks = total_bytes // BSIZE
     if blocks < 10:
@@ -169,8 +173,12 @@ def main():
     parser = argparse.ArgumentParser(description="Create lab7 filesystem image")
     parser.add_argument("output", help="output image path")
     parser.add_argument("size_mb", type=int, help="image size in MB")
+    parser.add_argument("swap_mb", type=int, nargs="?", default=0,
+                        help="swap area appended after the filesystem, in MB")
     args = parser.parse_args()
-    create_image(args.output, args.size_mb)
+    create_image(args.output, args.size_mb, args.swap_mb)
+    if args.swap_mb:
+        print(f"[mkfs] swap={args.swap_mb}MB after the filesystem")
 
 
 if __name__ == "__main__":
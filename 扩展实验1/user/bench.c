@@ -0,0 +1,321 @@
+#include "user/user.h"
+
+// 微基准测试程序: bench <模式>
+// 计时使用 rdtime (QEMU virt 的 timebase 为 10MHz, 1 tick = 100ns)
+
+#define BENCH_SYSCALL_ITERS 10000
+#define BENCH_PINGPONG_ITERS 1000
+#define BENCH_EXEC_ITERS 50
+#define BENCH_FORK_ITERS 200
+#define BENCH_SCAN_BYTES (64 * 1024)
+#define BENCH_SCAN_CHUNK 4096
+#define BENCH_HUGE_BYTES (64 * 1024 * 1024)
+#define BENCH_HUGE_ALIGN (2 * 1024 * 1024)
+#define BENCH_HUGE_STRIDE 4096
+#define BENCH_HUGE_PASSES 8
+#define BENCH_BIG_CHUNK (64 * 1024 * 1024)
+#define BENCH_BIG_PERCENT 75
+#define NS_PER_TICK 100
+
+static void write_str(const char *s)
+{
+    write(1, s, strlen(s));
+}
+
+static void write_dec(uint64 value)
+{
+    char buf[24];
+    int pos = 0;
+    if (value == 0) {
+        buf[pos++] = '0';
+    }
+    while (value > 0 && pos < (int)sizeof(buf)) {
+        buf[pos++] = '0' + (value % 10);
+        value /= 10;
+    }
+    while (pos > 0) {
+        write(1, &buf[--pos], 1);
+    }
+}
+
+static inline uint64 rdtime(void)
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+static int streq(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void report(const char *name, uint64 ticks, uint64 iters)
+{
+    write_str("[bench] ");
+    write_str(name);
+    write_str(": iters=");
+    write_dec(iters);
+    write_str(" total_ns=");
+    write_dec(ticks * NS_PER_TICK);
+    write_str(" avg_ns=");
+    write_dec(ticks * NS_PER_TICK / iters);
+    write_str("\n");
+}
+
+// 系统调用往返: 每次 getpid 都经过 trampoline 的两次 satp 切换
+static void bench_syscall(void)
+{
+    getpid();
+    uint64 start = rdtime();
+    for (int i = 0; i < BENCH_SYSCALL_ITERS; i++) {
+        getpid();
+    }
+    report("syscall getpid", rdtime() - start, BENCH_SYSCALL_ITERS);
+}
+
+// 进程间乒乓: 每一轮包含两次地址空间切换
+static void bench_pingpong(void)
+{
+    int p2c[2], c2p[2];
+    char b = 0;
+    if (pipe(p2c) < 0 || pipe(c2p) < 0) {
+        write_str("[bench] pipe failed\n");
+        return;
+    }
+    int pid = fork();
+    if (pid < 0) {
+        write_str("[bench] fork failed\n");
+        return;
+    }
+    if (pid == 0) {
+        close(p2c[1]);
+        close(c2p[0]);
+        while (read(p2c[0], &b, 1) == 1) {
+            write(c2p[1], &b, 1);
+        }
+        exit(0);
+    }
+    close(p2c[0]);
+    close(c2p[1]);
+    uint64 start = rdtime();
+    for (int i = 0; i < BENCH_PINGPONG_ITERS; i++) {
+        write(p2c[1], &b, 1);
+        read(c2p[0], &b, 1);
+    }
+    uint64 ticks = rdtime() - start;
+    close(p2c[1]);
+    close(c2p[0]);
+    wait(0);
+    report("pipe ping-pong", ticks, BENCH_PINGPONG_ITERS);
+}
+
+// fork + exec + exit + wait 的往返延迟, 子进程执行 "bench nop" 后立即退出
+static void bench_exec(void)
+{
+    uint64 start = rdtime();
+    for (int i = 0; i < BENCH_EXEC_ITERS; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            write_str("[bench] fork failed\n");
+            return;
+        }
+        if (pid == 0) {
+            const char *argv[] = { "bench", "nop", 0 };
+            exec("/bench", (char**)argv);
+            exit(-1);
+        }
+        wait(0);
+    }
+    report("fork+exec+wait", rdtime() - start, BENCH_EXEC_ITERS);
+}
+
+// fork + exit + wait 的往返延迟, 衡量进程创建和回收本身的开销
+static void bench_fork(void)
+{
+    uint64 start = rdtime();
+    for (int i = 0; i < BENCH_FORK_ITERS; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            write_str("[bench] fork failed\n");
+            return;
+        }
+        if (pid == 0) {
+            exit(0);
+        }
+        wait(0);
+    }
+    report("fork+exit+wait", rdtime() - start, BENCH_FORK_ITERS);
+}
+
+// 扫描同一个文件: read() 逐块读入 vs mmap 之后直接访问 (每块不需要系统调用)
+static void bench_scan(void)
+{
+    char *buf = sbrk(BENCH_SCAN_CHUNK);
+    if (buf == (char*)-1) {
+        write_str("[bench] sbrk failed\n");
+        return;
+    }
+    unlink("/benchscan");
+    int fd = open("/benchscan", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        write_str("[bench] open failed\n");
+        return;
+    }
+    for (int i = 0; i < BENCH_SCAN_CHUNK; i++) {
+        buf[i] = (char)i;
+    }
+    for (int off = 0; off < BENCH_SCAN_BYTES; off += BENCH_SCAN_CHUNK) {
+        write(fd, buf, BENCH_SCAN_CHUNK);
+    }
+    close(fd);
+
+    uint64 sum_read = 0, sum_mmap = 0;
+    fd = open("/benchscan", O_RDONLY);
+    uint64 start = rdtime();
+    int n;
+    while ((n = read(fd, buf, BENCH_SCAN_CHUNK)) > 0) {
+        for (int i = 0; i < n; i++) {
+            sum_read += (uint8)buf[i];
+        }
+    }
+    uint64 ticks = rdtime() - start;
+    report("scan read()", ticks, BENCH_SCAN_BYTES / BENCH_SCAN_CHUNK);
+    close(fd);
+
+    fd = open("/benchscan", O_RDONLY);
+    start = rdtime();
+    uint8 *m = mmap(0, BENCH_SCAN_BYTES, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+        write_str("[bench] mmap failed\n");
+    } else {
+        for (int i = 0; i < BENCH_SCAN_BYTES; i++) {
+            sum_mmap += m[i];
+        }
+        munmap(m, BENCH_SCAN_BYTES);
+        ticks = rdtime() - start;
+        report("scan mmap", ticks, BENCH_SCAN_BYTES / BENCH_SCAN_CHUNK);
+    }
+    close(fd);
+    unlink("/benchscan");
+    sbrk(-BENCH_SCAN_CHUNK);
+    if (sum_read != sum_mmap) {
+        write_str("[bench] scan checksum mismatch\n");
+    }
+}
+
+// 以 4KiB 步长遍历 64MiB 的堆数组: 每次访问都落在不同的页上, 主要开销是 TLB 缺失;
+// 堆按 2MiB 对齐后内核可以用大页映射 (对比 make VM_NO_THP=1)
+static void bench_huge(void)
+{
+    uint64 cur = (uint64)sbrk(0);
+    uint64 pad = (BENCH_HUGE_ALIGN - cur % BENCH_HUGE_ALIGN) % BENCH_HUGE_ALIGN;
+    char *base = sbrk(pad + BENCH_HUGE_BYTES);
+    if (base == (char*)-1) {
+        write_str("[bench] sbrk failed\n");
+        return;
+    }
+    char *arr = base + pad;
+    uint64 npages = BENCH_HUGE_BYTES / BENCH_HUGE_STRIDE;
+
+    // 第一遍写入触发按需分配
+    uint64 start = rdtime();
+    for (uint64 i = 0; i < BENCH_HUGE_BYTES; i += BENCH_HUGE_STRIDE) {
+        arr[i] = 1;
+    }
+    report("huge touch", rdtime() - start, npages);
+
+    uint64 sum = 0;
+    start = rdtime();
+    for (int pass = 0; pass < BENCH_HUGE_PASSES; pass++) {
+        for (uint64 i = 0; i < BENCH_HUGE_BYTES; i += BENCH_HUGE_STRIDE) {
+            sum += (uint8)arr[i];
+        }
+    }
+    report("huge stride", rdtime() - start, npages * BENCH_HUGE_PASSES);
+    sbrk(-(int)(pad + BENCH_HUGE_BYTES));
+    if (sum != npages * BENCH_HUGE_PASSES) {
+        write_str("[bench] huge checksum mismatch\n");
+    }
+}
+
+// 把当前空闲内存的大约四分之三分配给堆并逐页写入, 再校验一遍后归还;
+// 在 make qemu MEM=1G 下可以验证内核按设备树给出的内存大小管理全部物理页
+static void bench_bigmem(void)
+{
+    struct memstat_sys st;
+    if (memstat(MEMSTAT_SYSTEM, &st) < 0) {
+        write_str("[bench] memstat failed\n");
+        return;
+    }
+    uint64 want = (uint64)st.free_pages * BENCH_BIG_PERCENT / 100 * 4096;
+    want -= want % BENCH_BIG_CHUNK;
+    if (want == 0) {
+        write_str("[bench] bigmem: not enough free memory\n");
+        return;
+    }
+    char *base = sbrk(0);
+    uint64 got = 0;
+    // sbrk 的参数是 int, 分块扩大堆
+    while (got < want && sbrk(BENCH_BIG_CHUNK) != (char*)-1) {
+        got += BENCH_BIG_CHUNK;
+    }
+    if (got == 0) {
+        write_str("[bench] sbrk failed\n");
+        return;
+    }
+    uint64 npages = got / 4096;
+
+    uint64 start = rdtime();
+    for (uint64 i = 0; i < npages; i++) {
+        *(uint64*)(base + i * 4096) = i;
+    }
+    report("bigmem touch", rdtime() - start, npages);
+
+    uint64 bad = 0;
+    start = rdtime();
+    for (uint64 i = 0; i < npages; i++) {
+        if (*(uint64*)(base + i * 4096) != i) {
+            bad++;
+        }
+    }
+    report("bigmem verify", rdtime() - start, npages);
+    write_str("[bench] bigmem: total_mib=");
+    write_dec((uint64)st.total_pages * 4096 >> 20);
+    write_str(" used_mib=");
+    write_dec(got >> 20);
+    write_str("\n");
+    for (uint64 left = got; left > 0; left -= BENCH_BIG_CHUNK) {
+        sbrk(-BENCH_BIG_CHUNK);
+    }
+    if (bad != 0) {
+        write_str("[bench] bigmem checksum mismatch\n");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *mode = (argc > 1) ? argv[1] : "all";
+    int all = streq(mode, "all");
+
+    if (all || streq(mode, "syscall"))
+        bench_syscall();
+    if (all || streq(mode, "pingpong"))
+        bench_pingpong();
+    if (all || streq(mode, "scan"))
+        bench_scan();
+    if (all || streq(mode, "exec"))
+        bench_exec();
+    if (all || streq(mode, "fork"))
+        bench_fork();
+    if (all || streq(mode, "huge"))
+        bench_huge();
+    if (all || streq(mode, "bigmem"))
+        bench_bigmem();
+    exit(0);
+}
@@ -1,4 +1,5 @@
 #include "user/user.h"
+#include "mem/ksm.h"
 
 #ifndef ENABLE_LOGREAD
 #define ENABLE_LOGREAD 0
@@ -116,6 +117,575 @@ static void priority_test(void)
     write_str("[priority_test] done\n");
 }
 
+#define COW_TEST_PAGES 16
+
+// fork 之后父子进程共享页面 (写时复制), 检查双方的写入互不可见
+static void cow_test(void)
+{
+    write_str("[cow_test] start\n");
+    char *buf = sbrk(COW_TEST_PAGES * 4096);
+    if (buf == (char*)-1) {
+        write_str("[cow_test] sbrk failed\n");
+        return;
+    }
+    for (int i = 0; i < COW_TEST_PAGES; i++) {
+        buf[i * 4096] = 'A' + i;
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        write_str("[cow_test] fork failed\n");
+        return;
+    }
+    if (pid == 0) {
+        for (int i = 0; i < COW_TEST_PAGES; i++) {
+            if (buf[i * 4096] != 'A' + i) {
+                write_str("[cow_test] child saw wrong data\n");
+                exit(1);
+            }
+            buf[i * 4096] = 'a' + i;
+        }
+        exit(0);
+    }
+
+    int status = 0;
+    wait(&status);
+    int ok = (status == 0);
+    for (int i = 0; i < COW_TEST_PAGES; i++) {
+        if (buf[i * 4096] != 'A' + i) {
+            ok = 0;
+        }
+    }
+    sbrk(-(COW_TEST_PAGES * 4096));
+    write_str(ok ? "[cow_test] ok\n" : "[cow_test] FAILED\n");
+}
+
+#define LAZY_TEST_PAGES 256
+
+// sbrk 只扩大地址空间: 只有被访问的页面才会分配物理内存
+static void lazy_test(void)
+{
+    write_str("[lazy_test] start\n");
+    char *buf = sbrk(LAZY_TEST_PAGES * 4096);
+    if (buf == (char*)-1) {
+        write_str("[lazy_test] sbrk failed\n");
+        return;
+    }
+    int ok = 1;
+    // 每 16 页写一个字节, 其余页面从未访问
+    for (int i = 0; i < LAZY_TEST_PAGES; i += 16) {
+        if (buf[i * 4096] != 0) {
+            ok = 0;
+        }
+        buf[i * 4096] = 'x';
+    }
+    // 内核经 copyin 读取一个从未访问过的页面, 同样按需分配并读到 0
+    int fds[2];
+    char c = 'x';
+    if (pipe(fds) < 0 || write(fds[1], buf + 3 * 4096, 1) != 1 ||
+        read(fds[0], &c, 1) != 1 || c != 0) {
+        ok = 0;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    sbrk(-(LAZY_TEST_PAGES * 4096));
+    write_str(ok ? "[lazy_test] ok\n" : "[lazy_test] FAILED\n");
+}
+
+#define MMAP_TEST_PAGES 3
+#define MMAP_TEST_BLK   512
+
+// 检查从文件当前偏移读出的下一块是否以字符 c 开头
+static int mmap_test_expect(int fd, char c)
+{
+    char blk[MMAP_TEST_BLK];
+    return read(fd, blk, MMAP_TEST_BLK) == MMAP_TEST_BLK && blk[0] == c;
+}
+
+// 文件映射 (私有/共享) 与匿名共享映射
+static void mmap_test(void)
+{
+    write_str("[mmap_test] start\n");
+    uint64 len = MMAP_TEST_PAGES * 4096;
+    int nblk = (int)(len / MMAP_TEST_BLK);
+    char blk[MMAP_TEST_BLK];
+    int ok = 1;
+
+    unlink("/mmaptest");
+    int fd = open("/mmaptest", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        write_str("[mmap_test] open failed\n");
+        return;
+    }
+    for (int i = 0; i < nblk; i++) {
+        for (int j = 0; j < MMAP_TEST_BLK; j++) {
+            blk[j] = 'a' + i % 26;
+        }
+        write(fd, blk, MMAP_TEST_BLK);
+    }
+
+    // 私有映射: 内容来自文件, 写入不会写回
+    char *priv = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (priv == MAP_FAILED) {
+        write_str("[mmap_test] private mmap failed\n");
+        ok = 0;
+    } else {
+        for (int i = 0; i < nblk; i++) {
+            if (priv[i * MMAP_TEST_BLK] != 'a' + i % 26) {
+                ok = 0;
+            }
+        }
+        priv[0] = 'X';
+        munmap(priv, len);
+    }
+
+    // 共享映射: 脏页在 munmap 时写回文件
+    char *shared = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (shared == MAP_FAILED) {
+        write_str("[mmap_test] shared mmap failed\n");
+        ok = 0;
+    } else {
+        shared[4096] = 'Y';
+        munmap(shared, len);
+    }
+    close(fd);
+
+    fd = open("/mmaptest", O_RDONLY);
+    if (fd < 0 || !mmap_test_expect(fd, 'a')) {
+        ok = 0;
+    }
+    for (int i = 1; i < 4096 / MMAP_TEST_BLK; i++) {
+        mmap_test_expect(fd, 'a' + i);
+    }
+    if (!mmap_test_expect(fd, 'Y')) {
+        ok = 0;
+    }
+    close(fd);
+    unlink("/mmaptest");
+
+    // 匿名共享映射: fork 之后父子进程看到同一页
+    int *counter = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counter == MAP_FAILED) {
+        write_str("[mmap_test] anonymous mmap failed\n");
+        ok = 0;
+    } else {
+        *counter = 1;
+        int pid = fork();
+        if (pid == 0) {
+            *counter = 42;
+            exit(0);
+        }
+        wait(0);
+        if (pid < 0 || *counter != 42) {
+            ok = 0;
+        }
+        munmap(counter, 4096);
+    }
+    write_str(ok ? "[mmap_test] ok\n" : "[mmap_test] FAILED\n");
+}
+
+#define MADV_TEST_PAGES 16
+
+// 通过 memstat 在进程表中找到自己, 找不到返回 0
+static int self_memstat(struct memstat_proc *st)
+{
+    int pid = getpid();
+    for (int slot = 0; memstat(slot, st) >= 0; slot++) {
+        if (st->pid == pid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 当前进程映射着的用户页数
+static uint64 self_rss(void)
+{
+    struct memstat_proc st;
+    return self_memstat(&st) ? st.rss : 0;
+}
+
+// 系统中指向共享零页的映射数
+static uint32 zero_maps(void)
+{
+    struct memstat_sys st;
+    if (memstat(MEMSTAT_SYSTEM, &st) < 0) {
+        return 0;
+    }
+    return st.zero_maps;
+}
+
+// 已初始化的全局变量位于程序映像的 .data 中, madvise 必须拒绝
+static volatile int madv_global = 42;
+
+// 在堆中间挖掉一段: DONTNEED 之后物理页被归还, 再次访问得到零页; WILLNEED 预先填充
+static void madvise_test(void)
+{
+    write_str("[madvise_test] start\n");
+    // 多要一页, 保证测试区间按页对齐
+    char *raw = sbrk((MADV_TEST_PAGES + 1) * 4096);
+    if (raw == (char*)-1) {
+        write_str("[madvise_test] sbrk failed\n");
+        return;
+    }
+    char *buf = (char*)(((uint64)raw + 4095) & ~4095ull);
+    for (int i = 0; i < MADV_TEST_PAGES; i++) {
+        buf[i * 4096] = 'a' + i;
+    }
+    int ok = 1;
+    uint64 before = self_rss();
+    char *hole = buf + 4 * 4096;
+    if (madvise(hole, 8 * 4096, MADV_DONTNEED) < 0 || self_rss() + 8 != before) {
+        ok = 0;
+    }
+    // 空洞两侧的页面不受影响, 空洞中的页面重新变成零页
+    if (buf[3 * 4096] != 'a' + 3 || buf[12 * 4096] != 'a' + 12 || hole[0] != 0) {
+        ok = 0;
+    }
+    // WILLNEED 为空洞分配私有页 (rss 不含零页), 上面读 hole[0] 留下的零页映射也被换掉
+    uint32 maps = zero_maps();
+    if (madvise(hole, 8 * 4096, MADV_WILLNEED) < 0 || self_rss() != before || zero_maps() + 1 != maps) {
+        ok = 0;
+    }
+    // 程序映像和用户栈不在堆中: 写过的 .data 页面被丢弃后会变成零页
+    madv_global = 43;
+    char *gpage = (char*)((uint64)&madv_global & ~4095ull);
+    if (madvise(gpage, 4096, MADV_DONTNEED) == 0 || madvise(gpage, 4096, MADV_WILLNEED) == 0 ||
+        madv_global != 43) {
+        ok = 0;
+    }
+    // 区间超出堆且不在任何映射中
+    if (madvise(buf, (MADV_TEST_PAGES + 64) * 4096, MADV_DONTNEED) == 0) {
+        ok = 0;
+    }
+    sbrk(-((MADV_TEST_PAGES + 1) * 4096));
+    write_str(ok ? "[madvise_test] ok\n" : "[madvise_test] FAILED\n");
+}
+
+#define ZERO_TEST_PAGES 32
+
+// 只读过的堆页面都映射到共享零页, 不消耗物理页; 写入一页时只有这一页换成私有页
+static void zero_page_test(void)
+{
+    write_str("[zero_page_test] start\n");
+    char *raw = sbrk((ZERO_TEST_PAGES + 1) * 4096);
+    if (raw == (char*)-1) {
+        write_str("[zero_page_test] sbrk failed\n");
+        return;
+    }
+    char *buf = (char*)(((uint64)raw + 4095) & ~4095ull);
+    int ok = 1;
+    uint32 maps = zero_maps();
+    int sum = 0;
+    for (int i = 0; i < ZERO_TEST_PAGES; i++) {
+        sum += buf[i * 4096];
+    }
+    if (sum != 0 || zero_maps() != maps + ZERO_TEST_PAGES) {
+        ok = 0;
+    }
+    buf[5 * 4096 + 7] = 'z';
+    if (buf[5 * 4096 + 7] != 'z' || buf[5 * 4096] != 0 || buf[6 * 4096 + 7] != 0 ||
+        zero_maps() != maps + ZERO_TEST_PAGES - 1) {
+        ok = 0;
+    }
+    sbrk(-((ZERO_TEST_PAGES + 1) * 4096));
+    if (zero_maps() != maps) {
+        ok = 0;
+    }
+    write_str(ok ? "[zero_page_test] ok\n" : "[zero_page_test] FAILED\n");
+}
+
+#define WS_TEST_PAGES 64
+#define WS_TEST_HOT 8
+
+// 先写满一批页面, 之后只反复访问其中几页: 几个采样周期后其余页面应当变冷
+static void ws_test(void)
+{
+    write_str("[ws_test] start\n");
+    char *raw = sbrk((WS_TEST_PAGES + 1) * 4096);
+    if (raw == (char*)-1) {
+        write_str("[ws_test] sbrk failed\n");
+        return;
+    }
+    char *buf = (char*)(((uint64)raw + 4095) & ~4095ull);
+    for (int i = 0; i < WS_TEST_PAGES; i++) {
+        buf[i * 4096] = (char)i;
+    }
+    // 醒来返回用户态时采样一次, 此时所有页面都刚被访问过
+    sleep(WS_SAMPLE_TICKS * 2);
+    for (int i = 0; i < WS_TEST_HOT; i++) {
+        buf[i * 4096]++;
+    }
+    // 睡过 WS_WINDOW 个以上的周期, 没有再访问的页面年龄超过窗口
+    sleep(WS_SAMPLE_TICKS * (WS_WINDOW + 1));
+    struct memstat_proc st;
+    int ok = self_memstat(&st) && st.ws.samples >= 2 &&
+             st.ws.hot >= WS_TEST_HOT && st.ws.cold >= WS_TEST_PAGES - WS_TEST_HOT &&
+             st.ws.wss_peak >= WS_TEST_PAGES;
+    write_str("[ws_test] wss=");
+    write_dec(st.ws.wss);
+    write_str(" peak=");
+    write_dec(st.ws.wss_peak);
+    write_str(" hot=");
+    write_dec(st.ws.hot);
+    write_str(" cold=");
+    write_dec(st.ws.cold);
+    write_str("\n");
+    sbrk(-((WS_TEST_PAGES + 1) * 4096));
+    write_str(ok ? "[ws_test] ok\n" : "[ws_test] FAILED\n");
+}
+
+#define EXIT_TEST_PAGES 256
+#define EXIT_TEST_SLACK 16
+#define PROC_STATE_ZOMBIE 5
+
+// 在进程表中查找 pid, 返回它的状态, 不存在返回 -1
+static int proc_state(int pid)
+{
+    struct memstat_proc st;
+    for (int slot = 0;; slot++) {
+        int r = memstat(slot, &st);
+        if (r < 0) {
+            return -1;
+        }
+        if (r == 1 && st.pid == pid) {
+            return st.state;
+        }
+    }
+}
+
+static uint32 user_pages(void)
+{
+    struct memstat_sys st;
+    return memstat(MEMSTAT_SYSTEM, &st) < 0 ? 0 : st.user_pages;
+}
+
+// 子进程一退出 (父进程还没有 wait) 它的用户页就应当归还; 父进程先退出的孙进程由内核自动回收
+static void exit_test(void)
+{
+    write_str("[exit_test] start\n");
+    int ok = 1;
+    uint32 before = user_pages();
+    int pid = fork();
+    if (pid < 0) {
+        write_str("[exit_test] fork failed\n");
+        return;
+    }
+    if (pid == 0) {
+        char *buf = sbrk(EXIT_TEST_PAGES * 4096);
+        if (buf != (char*)-1) {
+            for (int i = 0; i < EXIT_TEST_PAGES; i++) {
+                buf[i * 4096] = 1;
+            }
+        }
+        exit(0);
+    }
+    for (int i = 0; i < 100 && proc_state(pid) != PROC_STATE_ZOMBIE; i++) {
+        sleep(1);
+    }
+    uint32 after = user_pages();
+    if (proc_state(pid) != PROC_STATE_ZOMBIE || after > before + EXIT_TEST_SLACK) {
+        ok = 0;
+    }
+    write_str("[exit_test] user pages before=");
+    write_dec(before);
+    write_str(" after child exit=");
+    write_dec(after);
+    write_str("\n");
+    if (wait(0) != pid) {
+        ok = 0;
+    }
+
+    // 中间进程立即退出, 孙进程过继给 init, 退出后不需要任何人 wait
+    int gpid_pipe[2];
+    if (pipe(gpid_pipe) < 0) {
+        write_str("[exit_test] pipe failed\n");
+        return;
+    }
+    pid = fork();
+    if (pid == 0) {
+        int g = fork();
+        if (g == 0) {
+            sleep(5);
+            exit(0);
+        }
+        write(gpid_pipe[1], &g, sizeof(g));
+        exit(0);
+    }
+    int g = -1;
+    read(gpid_pipe[0], &g, sizeof(g));
+    close(gpid_pipe[0]);
+    close(gpid_pipe[1]);
+    if (wait(0) != pid || g <= 0) {
+        ok = 0;
+    }
+    for (int i = 0; i < 100 && proc_state(g) >= 0; i++) {
+        sleep(1);
+    }
+    if (g > 0 && proc_state(g) >= 0) {
+        ok = 0;
+    }
+    write_str(ok ? "[exit_test] ok\n" : "[exit_test] FAILED\n");
+}
+
+#define SBRK_STRESS_ROUNDS 64
+#define SBRK_STRESS_BYTES (3 * 1024 * 1024 + 8192)
+#define SBRK_STRESS_SLACK 4
+
+// 反复扩大/缩小堆并写满: 缩小时变空的页表页应当被回收, 内核页和页表页的数量保持不变
+static void sbrk_stress_test(void)
+{
+    write_str("[sbrk_stress] start\n");
+    struct memstat_sys st;
+    if (memstat(MEMSTAT_SYSTEM, &st) < 0) {
+        write_str("[sbrk_stress] memstat failed\n");
+        return;
+    }
+    uint32 pgtbl0 = st.pgtbl_pages;
+    uint32 kernel0 = st.kernel_pages;
+    int ok = 1;
+    for (int r = 0; r < SBRK_STRESS_ROUNDS && ok; r++) {
+        char *buf = sbrk(SBRK_STRESS_BYTES);
+        if (buf == (char*)-1) {
+            ok = 0;
+            break;
+        }
+        for (int off = 0; off < SBRK_STRESS_BYTES; off += 4096) {
+            buf[off] = (char)r;
+        }
+        sbrk(-SBRK_STRESS_BYTES);
+        memstat(MEMSTAT_SYSTEM, &st);
+        if (st.pgtbl_pages > pgtbl0 + SBRK_STRESS_SLACK || st.kernel_pages > kernel0 + SBRK_STRESS_SLACK) {
+            ok = 0;
+        }
+    }
+    write_str("[sbrk_stress] pgtbl pages before=");
+    write_dec(pgtbl0);
+    write_str(" after=");
+    write_dec(st.pgtbl_pages);
+    write_str(" kernel pages before=");
+    write_dec(kernel0);
+    write_str(" after=");
+    write_dec(st.kernel_pages);
+    write_str("\n");
+    write_str(ok ? "[sbrk_stress] ok\n" : "[sbrk_stress] FAILED\n");
+}
+
+#define KSM_TEST_PAGES 32
+#define KSM_TEST_ROUNDS 8
+
+static uint32 ksm_sharing(void)
+{
+    struct memstat_sys st;
+    return memstat(MEMSTAT_SYSTEM, &st) < 0 ? 0 : st.ksm_sharing;
+}
+
+static int ksm_check(uint64 *buf, int page, uint64 first)
+{
+    uint64 *w = buf + page * 512;
+    if (w[0] != first) {
+        return 0;
+    }
+    for (int i = 1; i < 512; i++) {
+        if (w[i] != 0x6b736d0000000000ull + i) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 两个子进程各自写满内容相同的页面, 睡过几个扫描周期后应当合并成一个稳定页;
+// 之后写入一页只会复制出这一页 (取消合并), 其余页面的内容不变
+static void ksm_child(int ready, int go)
+{
+    char *raw = sbrk((KSM_TEST_PAGES + 1) * 4096);
+    if (raw == (char*)-1) {
+        exit(1);
+    }
+    uint64 *buf = (uint64*)(((uint64)raw + 4095) & ~4095ull);
+    for (int p = 0; p < KSM_TEST_PAGES; p++) {
+        for (int i = 0; i < 512; i++) {
+            buf[p * 512 + i] = 0x6b736d0000000000ull + i;
+        }
+    }
+    // 扫描发生在返回用户态之前, 每次醒来都会推进一批
+    for (int r = 0; r < KSM_TEST_ROUNDS; r++) {
+        sleep(KSM_SCAN_TICKS + 1);
+    }
+    char c = 'k';
+    write(ready, &c, 1);
+    read(go, &c, 1);
+    int ok = 1;
+    buf[3 * 512] = 42;
+    for (int p = 0; p < KSM_TEST_PAGES; p++) {
+        if (!ksm_check(buf, p, p == 3 ? 42 : 0x6b736d0000000000ull)) {
+            ok = 0;
+        }
+    }
+    exit(ok ? 0 : 1);
+}
+
+static void ksm_test(void)
+{
+#ifdef VM_NO_KSM
+    write_str("[ksm_test] skipped (VM_NO_KSM)\n");
+#else
+    write_str("[ksm_test] start\n");
+    int ready[2], go[2];
+    if (pipe(ready) < 0 || pipe(go) < 0) {
+        write_str("[ksm_test] pipe failed\n");
+        return;
+    }
+    uint32 before = ksm_sharing();
+    int ok = 1;
+    int nchild = 0;
+    for (; nchild < 2; nchild++) {
+        int pid = fork();
+        if (pid < 0) {
+            write_str("[ksm_test] fork failed\n");
+            ok = 0;
+            break;
+        }
+        if (pid == 0) {
+            close(ready[0]);
+            close(go[1]);
+            ksm_child(ready[1], go[0]);
+        }
+    }
+    close(ready[1]);
+    close(go[0]);
+    char c;
+    for (int i = 0; i < nchild; i++) {
+        if (read(ready[0], &c, 1) != 1) {
+            ok = 0;
+        }
+    }
+    uint32 merged = ksm_sharing();
+    // 两个进程的 2 * KSM_TEST_PAGES 页最终映射同一个稳定页
+    if (merged < before + KSM_TEST_PAGES) {
+        ok = 0;
+    }
+    write_str("[ksm_test] sharing before=");
+    write_dec(before);
+    write_str(" merged=");
+    write_dec(merged);
+    write_str("\n");
+    c = 'g';
+    for (int i = 0; i < nchild; i++) {
+        write(go[1], &c, 1);
+    }
+    close(ready[0]);
+    close(go[1]);
+    for (int i = 0; i < nchild; i++) {
+        int status = 0;
+        if (wait(&status) < 0 || status != 0) {
+            ok = 0;
+        }
+    }
+    write_str(ok ? "[ksm_test] ok\n" : "[ksm_test] FAILED\n");
+#endif
+}
+
 static void run_elfdemo(void)
 {
     write_str("[init] running elfdemo (ELF loader test)\n");
@@ -162,6 +732,66 @@ static void run_msgdemo(void)
     write_str("\n");
 }
 
+static void run_shmdemo(void)
+{
+    write_str("[init] running shmdemo (shared memory test)\n");
+    int pid = fork();
+    if (pid < 0) {
+        write_str("[init] fork shmdemo failed\n");
+        return;
+    }
+    if (pid == 0) {
+        const char *argv[] = { "shmdemo", 0 };
+        exec("/shmdemo", (char**)argv);
+        write_str("exec shmdemo failed\n");
+        exit(-1);
+    }
+    int status = 0;
+    int w = wait(&status);
+    write_str("[init] shmdemo wait pid=");
+    write_dec(w);
+    write_str(" status=");
+    write_dec(status);
+    write_str("\n");
+}
+
+static void run_bench(const char *mode)
+{
+    write_str("[init] running bench ");
+    write_str(mode);
+    write_str("\n");
+    int pid = fork();
+    if (pid < 0) {
+        write_str("[init] fork bench failed\n");
+        return;
+    }
+    if (pid == 0) {
+        const char *argv[] = { "bench", mode, 0 };
+        exec("/bench", (char**)argv);
+        write_str("exec bench failed\n");
+        exit(-1);
+    }
+    int status = 0;
+    wait(&status);
+}
+
+static void run_ps(void)
+{
+    int pid = fork();
+    if (pid < 0) {
+        write_str("[init] fork ps failed\n");
+        return;
+    }
+    if (pid == 0) {
+        const char *argv[] = { "ps", 0 };
+        exec("/ps", (char**)argv);
+        write_str("exec ps failed\n");
+        exit(-1);
+    }
+    int status = 0;
+    wait(&status);
+}
+
 int
 main(void)
 {
@@ -177,7 +807,19 @@ main(void)
 #endif
     write_str("[init] running priority syscall test\n");
     priority_test();
+    cow_test();
+    lazy_test();
+    mmap_test();
+    madvise_test();
+    zero_page_test();
+    ws_test();
+    exit_test();
+    sbrk_stress_test();
+    ksm_test();
     run_elfdemo();
     run_msgdemo();
+    run_shmdemo();
+    run_bench("all");
+    run_ps();
     exit(0);
 }
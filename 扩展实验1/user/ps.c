@@ -0,0 +1,110 @@
+#include "user/user.h"
+
+// ps: 打印全局内存分布和每个进程的内存占用 (单位: 页, 1 页 = 4KiB)
+
+static const char *state_names[] = { "unused", "used", "runnable", "running", "sleeping", "zombie" };
+
+static void write_str(const char *s)
+{
+    write(1, s, strlen(s));
+}
+
+static void write_dec(uint64 value)
+{
+    char buf[24];
+    int pos = 0;
+    if (value == 0) {
+        buf[pos++] = '0';
+    }
+    while (value > 0 && pos < (int)sizeof(buf)) {
+        buf[pos++] = '0' + (value % 10);
+        value /= 10;
+    }
+    while (pos > 0) {
+        write(1, &buf[--pos], 1);
+    }
+}
+
+static void field(const char *name, uint64 value)
+{
+    write_str(" ");
+    write_str(name);
+    write_str("=");
+    write_dec(value);
+}
+
+static void print_system(void)
+{
+    struct memstat_sys st;
+    if (memstat(MEMSTAT_SYSTEM, &st) < 0) {
+        write_str("[ps] memstat failed\n");
+        return;
+    }
+    write_str("[ps] kernel image:");
+    field("pages", st.image_pages);
+    field("bcache", st.bcache_pages);
+    write_str("\n[ps] pmem:");
+    field("total", st.total_pages);
+    field("free", st.free_pages);
+    field("kernel", st.kernel_pages);
+    field("user", st.user_pages);
+    field("zero_maps", st.zero_maps);
+    field("ksm_shared", st.ksm_shared);
+    field("ksm_sharing", st.ksm_sharing);
+    write_str("\n[ps] kernel pages:");
+    field("pgtbl", st.pgtbl_pages);
+    field("slab", st.slab_pages);
+    field("pipe", st.pipe_pages);
+    field("proc", st.proc_pages);
+    write_str("\n[ps] procs:");
+    field("used", st.nproc);
+    field("max", st.nproc_max);
+    field("swap_used", st.swap_used);
+    field("swap_slots", st.swap_slots);
+    write_str("\n");
+}
+
+static void print_procs(void)
+{
+    struct memstat_proc st;
+    for (int slot = 0;; slot++) {
+        int r = memstat(slot, &st);
+        if (r < 0) {
+            break;
+        }
+        if (r == 0) {
+            continue;
+        }
+        write_str("[ps] pid=");
+        write_dec(st.pid);
+        write_str(" ");
+        write_str(st.name);
+        write_str(" ");
+        write_str(st.state >= 0 && st.state <= 5 ? state_names[st.state] : "?");
+        field("sz", (st.sz + 4095) / 4096);
+        field("rss", st.rss);
+        field("shared", st.shared);
+        field("swapped", st.swapped);
+        field("pgtbl", st.pgtbl_pages);
+        field("kern", st.kernel_pages);
+        field("minflt", st.minflt);
+        field("majflt", st.majflt);
+        write_str("\n[ps]   ws:");
+        field("wss", st.ws.wss);
+        field("peak", st.ws.wss_peak);
+        field("hot", st.ws.hot);
+        field("warm", st.ws.warm);
+        field("cold", st.ws.cold);
+        field("dirty", st.ws.dirty);
+        field("samples", st.ws.samples);
+        write_str("\n");
+    }
+}
+
+int
+main(void)
+{
+    print_system();
+    print_procs();
+    return 0;
+}
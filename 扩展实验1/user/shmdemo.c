@@ -0,0 +1,143 @@
+#include "user/user.h"
+
+// 共享内存演示: 父子进程通过同一个共享内存段来回传递 4 MiB 的缓冲区,
+// 管道里只传一个字节的通知, 数据本身不经过内核复制
+
+#define SHM_KEY 4321
+#define SHM_BYTES (4 * 1024 * 1024)
+#define SHM_WORDS (SHM_BYTES / sizeof(uint64))
+#define SHM_ROUNDS 4
+
+static void println(const char *s)
+{
+    write(1, s, strlen(s));
+    write(1, "\n", 1);
+}
+
+static void write_dec(uint64 value)
+{
+    char buf[24];
+    int pos = 0;
+    if (value == 0) {
+        buf[pos++] = '0';
+    }
+    while (value > 0 && pos < (int)sizeof(buf)) {
+        buf[pos++] = '0' + (value % 10);
+        value /= 10;
+    }
+    while (pos > 0) {
+        write(1, &buf[--pos], 1);
+    }
+}
+
+static inline uint64 rdtime(void)
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+// 检查缓冲区内容是否为 base + i
+static int check(uint64 *buf, uint64 base)
+{
+    for (uint64 i = 0; i < SHM_WORDS; i++) {
+        if (buf[i] != base + i) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void child(int id, int from_parent, int to_parent)
+{
+    // 子进程按 key 重新查找并映射同一个段, 拿到的是父进程写入的那批物理页
+    int cid = shmget(SHM_KEY, SHM_BYTES);
+    uint64 *buf = (uint64*)shmat(cid);
+    if (cid != id || buf == (uint64*)-1) {
+        println("[shmdemo-child] shmat failed");
+        exit(-1);
+    }
+    char token;
+    for (int r = 0; r < SHM_ROUNDS; r++) {
+        if (read(from_parent, &token, 1) != 1) {
+            exit(-1);
+        }
+        uint64 base = (uint64)r << 32;
+        if (!check(buf, base)) {
+            println("[shmdemo-child] bad data from parent");
+            exit(-1);
+        }
+        // 原地改写后交回父进程
+        for (uint64 i = 0; i < SHM_WORDS; i++) {
+            buf[i] += 1;
+        }
+        write(to_parent, &token, 1);
+    }
+    shmdt(buf);
+    exit(0);
+}
+
+int
+main(void)
+{
+    int id = shmget(SHM_KEY, SHM_BYTES);
+    if (id < 0) {
+        println("[shmdemo] shmget failed");
+        return -1;
+    }
+    int p2c[2], c2p[2];
+    if (pipe(p2c) < 0 || pipe(c2p) < 0) {
+        println("[shmdemo] pipe failed");
+        return -1;
+    }
+    int pid = fork();
+    if (pid < 0) {
+        println("[shmdemo] fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        close(p2c[1]);
+        close(c2p[0]);
+        child(id, p2c[0], c2p[1]);
+    }
+    close(p2c[0]);
+    close(c2p[1]);
+
+    uint64 *buf = (uint64*)shmat(id);
+    if (buf == (uint64*)-1) {
+        println("[shmdemo-parent] shmat failed");
+        return -1;
+    }
+    int ok = 1;
+    char token = 's';
+    uint64 start = rdtime();
+    for (int r = 0; r < SHM_ROUNDS && ok; r++) {
+        uint64 base = (uint64)r << 32;
+        for (uint64 i = 0; i < SHM_WORDS; i++) {
+            buf[i] = base + i;
+        }
+        write(p2c[1], &token, 1);
+        if (read(c2p[0], &token, 1) != 1 || !check(buf, base + 1)) {
+            ok = 0;
+        }
+    }
+    uint64 ticks = rdtime() - start;
+    close(p2c[1]);
+    close(c2p[0]);
+
+    int st = 0;
+    wait(&st);
+    shmdt(buf);
+    if (!ok || st != 0) {
+        println("[shmdemo] FAILED");
+        return -1;
+    }
+    write(1, "[shmdemo] ok: ", 14);
+    write_dec(SHM_ROUNDS);
+    write(1, " round trips of ", 16);
+    write_dec(SHM_BYTES / 1024);
+    write(1, " KiB, total_ns=", 15);
+    write_dec(ticks * 100);
+    write(1, "\n", 1);
+    return 0;
+}